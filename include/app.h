@@ -8,6 +8,11 @@
 #define LIBNEWRELIC_APP_H
 
 #include "nr_app.h"
+#include "nr_metric_accumulator.h"
+#include "nr_metric_aggregate.h"
+#include "pending.h"
+#include "refresher.h"
+#include "util_hashmap.h"
 
 /*! @brief The internal type used to represent an application. */
 typedef struct _nr_app_and_info_t {
@@ -23,6 +28,35 @@ typedef struct _nr_app_and_info_t {
 
   /*! The application lock. */
   nrthread_mutex_t lock;
+
+  /*! Refreshes the application information from the daemon in the
+   * background; NULL if the refresher could not be started. */
+  newrelic_refresher_t* refresher;
+
+  /*! Holds transactions that end before the application has connected, if
+   * it connects in the background; NULL otherwise. */
+  newrelic_pending_t* pending;
+
+  /*! Whether this application holds the process-wide background sender,
+   * which it must release when it is destroyed. */
+  bool sender_started;
+
+  /*! Custom metric names registered with newrelic_register_custom_metric(),
+   * keyed by name; NULL until the first is registered. Protected by the
+   * application lock. */
+  nr_hashmap_t* metric_handles;
+
+  /*! The metrics of finished transactions waiting to be sent, if
+   * sender.metric_aggregation_ms is set; NULL otherwise. */
+  nr_metric_aggregate_t* metric_aggregate;
+
+  /*! Metrics recorded outside of any transaction with
+   * newrelic_record_app_metric(). */
+  nr_metric_accumulator_t* metric_accumulator;
+
+  /*! When the aggregated and accumulated metrics were last sent. Protected
+   * by the application lock. */
+  nrtime_t metrics_sent;
 } nr_app_and_info_t;
 
 /*!
@@ -30,7 +64,9 @@ typedef struct _nr_app_and_info_t {
  *
  * @param [in] app An application.
  * @param [in] timeout_ms The amount of time, in milliseconds, for the
- * application to wait on the daemon to connect to New Relic.
+ * application to wait on the daemon to connect to New Relic. Unused if the
+ * application's configuration has startup.async set, in which case this
+ * function does not wait for the application to connect.
  *
  * @return NR_SUCCESS if successful; NR_FAILURE if any parameters are invalid or
  * the daemon was unable to connect.  A message at level LOG_ERROR will be
@@ -39,4 +75,14 @@ typedef struct _nr_app_and_info_t {
 nr_status_t newrelic_connect_app(newrelic_app_t* app,
                                  unsigned short timeout_ms);
 
+/*!
+ * @brief Send the application's aggregated transaction metrics, and the
+ * metrics recorded outside of any transaction, to the daemon, if they are
+ * due.
+ *
+ * @param [in] app An application.
+ * @param [in] force true to send the metrics whether or not they are due.
+ */
+void newrelic_app_send_metrics(newrelic_app_t* app, bool force);
+
 #endif /* LIBNEWRELIC_APP_H */
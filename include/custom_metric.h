@@ -0,0 +1,38 @@
+/*!
+ * @file custom_metric.h
+ *
+ * @brief Type definitions, constants, and function declarations necessary to
+ * support registered custom metrics in the C SDK.
+ */
+#ifndef LIBNEWRELIC_CUSTOM_METRIC_H
+#define LIBNEWRELIC_CUSTOM_METRIC_H
+
+#include <stddef.h>
+
+#include "libnewrelic.h"
+
+/*!
+ * @brief The internal registered custom metric struct
+ */
+typedef struct _newrelic_metric_handle_t {
+  /*! The metric name. */
+  char* name;
+
+  /*! The transaction metric slot the metric is recorded in. Slots are
+   * numbered in registration order within an application. */
+  size_t slot;
+
+  /*! The application the metric was registered with. As every application
+   * numbers its own slots, the handle is only used with its transactions. */
+  const newrelic_app_t* app;
+} newrelic_metric_handle_t;
+
+/*!
+ * @brief Destroy a registered custom metric.
+ *
+ * @param [in] handle The newrelic_metric_handle_t to destroy. This takes a
+ * void pointer so that it can be used as a hashmap destructor.
+ */
+void newrelic_metric_handle_destroy(void* handle);
+
+#endif /* LIBNEWRELIC_CUSTOM_METRIC_H */
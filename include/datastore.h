@@ -9,6 +9,30 @@
 
 #include "segment.h"
 
+/*!
+ * @brief Validate the parameters of a datastore segment.
+ *
+ * @param [in] params The parameters.
+ * @return True if the parameters are valid; false otherwise. A message at
+ * level LOG_ERROR will be logged if validation fails.
+ */
+extern bool newrelic_validate_datastore_segment_params(
+    const newrelic_datastore_segment_params_t* params);
+
+/*!
+ * @brief Make a started segment a datastore segment.
+ *
+ * The parameters are saved in the segment until it ends. This function
+ * assumes that the parameters are valid and that the transaction has already
+ * been locked.
+ *
+ * @param [in] segment The segment.
+ * @param [in] params  The parameters.
+ */
+extern void newrelic_init_datastore_segment(
+    newrelic_segment_t* segment,
+    const newrelic_datastore_segment_params_t* params);
+
 /*!
  * @brief Destroy the datastore-specific fields in a segment.
  *
@@ -12,6 +12,7 @@
 #define LIBNEWRELIC_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -338,6 +339,282 @@ typedef struct _newrelic_span_event_config_t {
   bool enabled;
 } newrelic_span_event_config_t;
 
+/**
+ * @brief Policies for the background sender when its queue is full.
+ *
+ * @see newrelic_sender_config_t
+ */
+typedef enum _newrelic_sender_drop_policy_t {
+  /**
+   * Drop nothing: the transaction that does not fit is sent from the thread
+   * ending it, which then waits on the daemon socket.
+   */
+  NEWRELIC_DROP_NONE,
+
+  /** Drop the transaction that does not fit. */
+  NEWRELIC_DROP_NEWEST,
+
+  /** Drop the transaction that has been queued the longest. */
+  NEWRELIC_DROP_OLDEST,
+
+  /**
+   * Drop the transaction with the lowest sampling priority, which may be the
+   * one that does not fit. These are the transactions least likely to be
+   * kept by sampling anyway.
+   */
+  NEWRELIC_DROP_LOWEST_PRIORITY,
+} newrelic_sender_drop_policy_t;
+
+/**
+ * @brief Configuration used to control how finished transactions are sent
+ * to the daemon.
+ *
+ */
+typedef struct _newrelic_sender_config_t {
+  /**
+   * @brief Specifies whether finished transactions are sent to the daemon
+   * from a background thread.
+   *
+   * When set to true, newrelic_end_transaction() hands the finished
+   * transaction to a thread owned by the C SDK, which encodes it and writes
+   * it to the daemon. The calling thread no longer waits on the daemon
+   * socket. The sender thread is shared by every application in the
+   * process, and is configured by the first application created with this
+   * field set to true. The default configuration returned by
+   * newrelic_create_app_config() sets this value to false.
+   */
+  bool async;
+
+  /**
+   * @brief The maximum number of finished transactions waiting to be sent
+   * by the background thread.
+   *
+   * If the queue is full when a transaction ends, drop_policy decides what
+   * happens. Only used when async is true. The default configuration
+   * returned by newrelic_create_app_config() sets this value to 1000.
+   */
+  unsigned int queue_size;
+
+  /**
+   * @brief What to do with a transaction that ends while the background
+   * sender's queue is full.
+   *
+   * Any policy other than NEWRELIC_DROP_NONE keeps newrelic_end_transaction()
+   * from ever waiting on the daemon, at the cost of losing transactions
+   * while the daemon is slow or down. Dropped transactions, and those the
+   * sender fails to write, are counted and reported with the next
+   * transaction sent successfully, as the
+   * Supportability/C/Sender/Dropped/QueueFull and
+   * Supportability/C/Sender/Dropped/SendFailed metrics. Only used when async
+   * is true. The default configuration returned by
+   * newrelic_create_app_config() sets this value to NEWRELIC_DROP_NONE.
+   */
+  newrelic_sender_drop_policy_t drop_policy;
+
+  /**
+   * @brief The maximum number of finished transactions the background thread
+   * writes to the daemon at once.
+   *
+   * When greater than 1, the background thread collects encoded
+   * transactions and writes them to the daemon with a single vectored write
+   * once this many are waiting, or once the oldest has waited for
+   * batch_timeout_ms, whichever happens first. This reduces the number of
+   * system calls made per transaction. Only used when async is true. The
+   * default configuration returned by newrelic_create_app_config() sets this
+   * value to 1, which writes every transaction as soon as it is dequeued.
+   */
+  unsigned int batch_size;
+
+  /**
+   * @brief The maximum time, in milliseconds, that a transaction waits in a
+   * partially filled batch before the batch is written to the daemon.
+   *
+   * Only used when async is true and batch_size is greater than 1. The
+   * default configuration returned by newrelic_create_app_config() sets this
+   * value to 100.
+   */
+  unsigned int batch_timeout_ms;
+
+  /**
+   * @brief The number of connections opened to the daemon.
+   *
+   * Each thread that sends transactions is assigned one of these
+   * connections, and each connection is locked independently, so threads
+   * using different connections do not wait on each other. Like the sender
+   * thread, the connections are shared by every application in the process;
+   * the most recently created application sets the count. Must be between 1
+   * and 64. The default configuration returned by newrelic_create_app_config()
+   * sets this value to 1.
+   */
+  unsigned int daemon_connections;
+
+  /**
+   * @brief The size, in bytes, of the shared memory ring used to send
+   * transactions to the daemon, or 0 to send them over the daemon socket.
+   *
+   * When non-zero, each daemon connection creates a memory mapped ring file
+   * and asks the daemon to read transactions from it. Transactions are then
+   * copied into the ring instead of being written to the socket, which
+   * avoids a system call and two kernel copies per transaction. The daemon
+   * must run on the same host and be able to open files created by this
+   * process; otherwise, and whenever the ring is full, transactions are
+   * sent over the socket as usual. The size is rounded up to a power of two
+   * of at least 64 kilobytes, and may be at most 1 gigabyte. Like the daemon
+   * connections, the ring is shared by every application in the process.
+   * The default configuration returned by newrelic_create_app_config() sets
+   * this value to 0.
+   */
+  unsigned int shared_memory_size;
+
+  /**
+   * @brief The path of a file in which transactions are kept while the
+   * daemon cannot be reached, or an empty string to not keep them.
+   *
+   * When set together with spool_size, transactions that end while the
+   * daemon socket is down, such as during a daemon restart, are appended to
+   * this memory mapped file instead of being lost. Once the daemon can be
+   * reached again they are sent to it in the order they ended, before any
+   * newer transactions. Transactions still in the file when the process
+   * exits are sent by the next process to use it. The file can only be
+   * used by one process at a time: it is locked while in use, and a process
+   * that finds it locked does not spool. Like the daemon
+   * connections, the spool is shared by every application in the process.
+   * The default configuration returned by newrelic_create_app_config() sets
+   * this value to an empty string.
+   */
+  char spool_filename[512];
+
+  /**
+   * @brief The size, in bytes, of the spool file.
+   *
+   * Once the spool is full, further transactions are lost until it has been
+   * replayed. Each transaction sent replays a few spooled transactions ahead
+   * of it, so the spool drains gradually rather than stalling one sender.
+   * Must be a multiple of 8 between 64 kilobytes and 1 gigabyte, or
+   * 0 to not keep transactions. Only used when spool_filename is set. The
+   * default configuration returned by newrelic_create_app_config() sets this
+   * value to 0.
+   */
+  unsigned int spool_size;
+
+  /**
+   * @brief How often, in milliseconds, the metrics of finished transactions
+   * are sent to the daemon, or 0 to send them with each transaction.
+   *
+   * When non-zero, the metrics of each finished transaction are merged into
+   * a table kept by the application, and the transaction is sent without
+   * them. The merged metrics are sent once this interval has passed, and
+   * when the application is destroyed. Services running many small
+   * transactions with few distinct names then send far less to the daemon.
+   * Metrics recorded with newrelic_record_app_metric() are sent at the same
+   * interval, or every 5 seconds when this is 0. The interval is checked
+   * about once a second, so values under 1000 behave like 1000. The default
+   * configuration returned by newrelic_create_app_config() sets this value
+   * to 0.
+   */
+  unsigned int metric_aggregation_ms;
+} newrelic_sender_config_t;
+
+/**
+ * @brief Configuration used to control how an application connects when it
+ * is created.
+ *
+ */
+typedef struct _newrelic_startup_config_t {
+  /**
+   * @brief Specifies whether newrelic_create_app() returns before the
+   * application has connected.
+   *
+   * When set to true, newrelic_create_app() does not wait for the daemon to
+   * connect the application to New Relic, and ignores its timeout_ms
+   * argument. The application connects in the background. Transactions
+   * started before it has connected are recorded with the default apdex
+   * threshold and event limits, held in memory when they end, and sent once
+   * the application has connected, with its server side configuration
+   * applied. If the application fails to connect, they are discarded. The
+   * default configuration returned by newrelic_create_app_config() sets this
+   * value to false.
+   */
+  bool async;
+
+  /**
+   * @brief The maximum number of ended transactions held while the
+   * application connects.
+   *
+   * Transactions that end while this many are held are discarded, and
+   * counted in the Supportability/C/Startup/Dropped metric once the
+   * application has connected. Only used when async is true. The default
+   * configuration returned by newrelic_create_app_config() sets this value
+   * to 1000.
+   */
+  unsigned int pending_transactions;
+
+  /**
+   * @brief The path of a file in which the application's connect
+   * information is kept between processes, or an empty string to not keep
+   * it.
+   *
+   * When set, the information New Relic sends when the application connects
+   * is written to this file. The next process to create the application with
+   * the same name, license key and host uses it straight away, so that
+   * newrelic_create_app() returns and transactions are recorded without
+   * waiting for the connection, while the daemon confirms in the background
+   * that it is still valid. If the daemon has since connected the
+   * application afresh, the new information replaces it; transactions that
+   * ended in the meantime may be rejected by the daemon. The file holds no
+   * license key, and is created readable and writable by its owner only.
+   * The default configuration returned by newrelic_create_app_config() sets
+   * this value to an empty string.
+   */
+  char cache_filename[512];
+} newrelic_startup_config_t;
+
+/**
+ * @brief Configuration used to control how segments are recorded.
+ *
+ */
+typedef struct _newrelic_segment_config_t {
+  /**
+   * @brief Specifies whether custom segments are recorded into per-thread
+   * buffers.
+   *
+   * By default every segment takes its transaction's lock when it starts and
+   * ends, which serialises threads that share a transaction. When set to
+   * true, custom segments started with newrelic_start_segment() are instead
+   * appended to a buffer belonging to the calling thread, without taking the
+   * lock, and are added to the transaction's segment tree when the
+   * transaction ends. A custom segment's default parent is then the
+   * innermost custom segment its thread started and has not ended, or the
+   * transaction's root segment if there is none, rather than the innermost
+   * segment of any type. Datastore and external segments are unaffected,
+   * and a buffered custom segment cannot be the parent or child of one. A
+   * distributed trace payload created for a buffered custom segment names
+   * the transaction's root segment as its parent, as the segment has no span
+   * until the transaction ends. The handles of buffered custom segments are
+   * freed when the transaction ends, so they must not be used afterwards.
+   * The default configuration returned by newrelic_create_app_config() sets
+   * this value to false.
+   */
+  bool thread_buffers;
+
+  /**
+   * @brief The number of ended segments a transaction keeps in full.
+   *
+   * Once a transaction has this many ended segments, each further segment
+   * that ends without children is folded into an aggregate segment with the
+   * same parent, name and type, rather than being kept. The metrics of a
+   * folded segment are recorded exactly, and the aggregate's transaction
+   * trace node gives the number of segments it stands for and their total,
+   * shortest and longest duration. This bounds the memory and end of
+   * transaction cost of transactions with very many segments, although the
+   * start and stop times of folded segments are still kept so that their
+   * parent's exclusive time stays exact. The default configuration returned
+   * by newrelic_create_app_config() sets this value to 0, which keeps every
+   * segment.
+   */
+  unsigned int max_segments;
+} newrelic_segment_config_t;
+
 /**
  * @brief Configuration used to describe application name, license key, as
  * well as optional transaction tracer and datastore configuration.
@@ -416,6 +693,31 @@ typedef struct _newrelic_app_config_t {
    */
   newrelic_span_event_config_t span_events;
 
+  /**
+   * @brief Optional. Transaction sender configuration.
+   *
+   * By default, the configuration returned by newrelic_create_app_config()
+   * sends finished transactions to the daemon from the thread that calls
+   * newrelic_end_transaction().
+   */
+  newrelic_sender_config_t sender;
+
+  /**
+   * @brief Optional. Application startup configuration.
+   *
+   * By default, the configuration returned by newrelic_create_app_config()
+   * makes newrelic_create_app() wait for the application to connect.
+   */
+  newrelic_startup_config_t startup;
+
+  /**
+   * @brief Optional. Segment configuration.
+   *
+   * By default, the configuration returned by newrelic_create_app_config()
+   * records every segment under its transaction's lock.
+   */
+  newrelic_segment_config_t segments;
+
 } newrelic_app_config_t;
 
 /**
@@ -542,6 +844,55 @@ typedef struct _newrelic_external_segment_params_t {
   char* library;
 } newrelic_external_segment_params_t;
 
+/**
+ * @brief A segment that has already completed, for
+ * newrelic_record_segments().
+ *
+ * A record describes a custom segment, unless its datastore or external field
+ * is set.
+ */
+typedef struct _newrelic_segment_record_t {
+  /**
+   * @brief The name of a custom segment.
+   *
+   * As with newrelic_start_segment(), a NULL name or a name that includes a
+   * slash is replaced with "Unnamed Segment".
+   */
+  const char* name;
+
+  /**
+   * @brief The category of a custom segment.
+   *
+   * As with newrelic_start_segment(), a NULL category or a category that
+   * includes a slash is replaced with "Custom".
+   */
+  const char* category;
+
+  /**
+   * @brief The start time of the segment, in microseconds since the start of
+   * the transaction.
+   */
+  newrelic_time_us_t start_time;
+
+  /** @brief The duration of the segment in microseconds. */
+  newrelic_time_us_t duration;
+
+  /**
+   * @brief The parameters of a datastore segment, or NULL.
+   *
+   * These are validated as by newrelic_start_datastore_segment().
+   */
+  const newrelic_datastore_segment_params_t* datastore;
+
+  /**
+   * @brief The parameters of an external segment, or NULL.
+   *
+   * These are validated as by newrelic_start_external_segment(). This field
+   * is ignored if the datastore field is set.
+   */
+  const newrelic_external_segment_params_t* external;
+} newrelic_segment_record_t;
+
 /**
  * @brief Configure the C SDK's logging system.
  *
@@ -644,7 +995,8 @@ bool newrelic_destroy_app_config(newrelic_app_config_t** config);
  *                        newrelic_create_app_config().
  * @param [in] timeout_ms Specifies the maximum time to wait for a connection to
  *                        be established; a value of 0 causes the method to make
- *                        only one attempt at connecting to the daemon.
+ *                        only one attempt at connecting to the daemon. Unused
+ *                        if the configuration's startup.async field is true.
  *
  * @return A pointer to an allocated application, or NULL on error; any errors
  * resulting from a badly-formed configuration are logged.
@@ -850,6 +1202,16 @@ typedef struct _newrelic_segment_t newrelic_segment_t;
  */
 typedef struct _newrelic_custom_event_t newrelic_custom_event_t;
 
+/**
+ * @brief A registered custom metric name.
+ *
+ * A custom metric name that is recorded often can be registered once with
+ * newrelic_register_custom_metric(). Recording through the returned handle
+ * with newrelic_record_custom_metric_handle() avoids hashing and looking up
+ * the name each time.
+ */
+typedef struct _newrelic_metric_handle_t newrelic_metric_handle_t;
+
 /**
  * @brief Record the start of a custom segment in a transaction.
  *
@@ -990,6 +1352,35 @@ bool newrelic_set_segment_timing(newrelic_segment_t* segment,
 bool newrelic_end_segment(newrelic_txn_t* transaction,
                           newrelic_segment_t** segment_ptr);
 
+/**
+ * @brief Record segments that have already completed in a transaction.
+ *
+ * Each record gives the timing of a segment, as
+ * newrelic_set_segment_timing() would, and the fields that would otherwise
+ * be passed to newrelic_start_segment(), newrelic_start_datastore_segment()
+ * or newrelic_start_external_segment(). Every segment is started, timed and
+ * ended while the transaction is locked once, so this is much cheaper than
+ * recording each segment with the individual calls. It is intended for tight
+ * loops and for replaying timings collected by another tracing layer.
+ *
+ * Records that fail validation are skipped; a message is written to the SDK
+ * log at LOG_ERROR level for each.
+ *
+ * @param [in] transaction An active transaction.
+ * @param [in] parent      The parent of the recorded segments, which must not
+ *                         have ended, or NULL for the transaction's root
+ *                         segment. It cannot be a custom segment recorded into
+ *                         a per-thread buffer.
+ * @param [in] records     An array of records.
+ * @param [in] count       The number of records.
+ *
+ * @return The number of segments recorded.
+ */
+size_t newrelic_record_segments(newrelic_txn_t* transaction,
+                                newrelic_segment_t* parent,
+                                const newrelic_segment_record_t* records,
+                                size_t count);
+
 /**
  * @brief Creates a custom event
  *
@@ -1128,6 +1519,99 @@ bool newrelic_record_custom_metric(newrelic_txn_t* transaction,
                                    const char* metric_name,
                                    double milliseconds);
 
+/**
+ * @brief Generate a custom distribution metric.
+ *
+ * Given an active transaction and valid parameters, this function records a
+ * custom metric as newrelic_record_custom_metric() does, and also keeps the
+ * recorded durations in a fixed-size sketch.
+ *
+ * When metrics are aggregated across transactions, with the
+ * sender.metric_aggregation_ms setting, the 50th, 95th and 99th percentiles
+ * of every duration recorded in each interval are estimated and sent with the
+ * metric as the metrics metric_name/p50, metric_name/p95 and metric_name/p99.
+ * The daemon adds up these metrics as it does any other over each harvest
+ * cycle, so the reported values are the average, minimum and maximum of the
+ * estimates of each interval. Without metric aggregation, and for
+ * transactions whose metrics do not fit in the aggregate, the metric is sent
+ * as newrelic_record_custom_metric() would send it, without percentiles, as
+ * the percentiles of single transactions cannot be combined into percentiles
+ * of the harvest cycle.
+ *
+ * @param [in] transaction An active transaction.
+ * @param [in] metric_name The name/identifier for the metric.
+ * @param [in] milliseconds The amount of time the metric will
+ *             record, in milliseconds.
+ *
+ * @return true on success.
+ */
+bool newrelic_record_distribution_metric(newrelic_txn_t* transaction,
+                                         const char* metric_name,
+                                         double milliseconds);
+
+/**
+ * @brief Generate a custom metric outside of any transaction.
+ *
+ * Given an application and valid parameters, this function records a custom
+ * metric that belongs to no transaction, such as a counter or gauge kept by a
+ * background thread or event loop. Each thread records into metrics of its
+ * own without taking a lock. The metrics of every thread are merged and sent
+ * to the daemon every sender.metric_aggregation_ms milliseconds, or every 5
+ * seconds if that is 0, and when the application is destroyed. Metrics
+ * recorded before the application has connected are kept until it has.
+ *
+ * @param [in] app An application.
+ * @param [in] metric_name The name/identifier for the metric.
+ * @param [in] milliseconds The amount of time the metric will
+ *             record, in milliseconds.
+ *
+ * @return true on success.
+ */
+bool newrelic_record_app_metric(newrelic_app_t* app,
+                                const char* metric_name,
+                                double milliseconds);
+
+/**
+ * @brief Register a custom metric name.
+ *
+ * Given an application and a metric name, this function returns a handle that
+ * records custom metrics with that name through
+ * newrelic_record_custom_metric_handle(). Registering the same name again
+ * returns the same handle.
+ *
+ * @param [in] app An application.
+ * @param [in] metric_name The name/identifier for the metric.
+ *
+ * @return A handle for the metric name, or NULL if the parameters are invalid.
+ * The handle is owned by the application and remains valid until
+ * newrelic_destroy_app() is called. It can be used with any transaction of the
+ * application.
+ */
+newrelic_metric_handle_t* newrelic_register_custom_metric(
+    newrelic_app_t* app,
+    const char* metric_name);
+
+/**
+ * @brief Generate a custom metric through a registered name.
+ *
+ * This function behaves as newrelic_record_custom_metric() does, with the
+ * metric name that was given to newrelic_register_custom_metric().
+ *
+ * @param [in] transaction An active transaction of the application the handle
+ *             was registered with.
+ * @param [in] handle A handle from newrelic_register_custom_metric().
+ * @param [in] milliseconds The amount of time the metric will
+ *             record, in milliseconds.
+ *
+ * @return true on success; false if the parameters are invalid, including if
+ * the handle was registered with a different application to the
+ * transaction's.
+ */
+bool newrelic_record_custom_metric_handle(
+    newrelic_txn_t* transaction,
+    const newrelic_metric_handle_t* handle,
+    double milliseconds);
+
 /**
  * @brief Ignore the current transaction
  *
@@ -1157,7 +1641,9 @@ bool newrelic_ignore_transaction(newrelic_txn_t* transaction);
  * @param [in] segment        An active segment in which the distributed trace
  *                            payload is being created, or NULL to indicate
  *                            that the payload is created for the root
- *                            segment.
+ *                            segment. A custom segment recorded into a
+ *                            per-thread buffer is treated as NULL; see
+ *                            newrelic_segment_config_t.thread_buffers.
  *
  * @return If successful, a string to manually add to a service's outbound
  * requests. If the instrumented application has not established a connection
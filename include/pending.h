@@ -0,0 +1,86 @@
+/*!
+ * @file pending.h
+ *
+ * @brief Function declarations necessary to support holding transactions
+ * that end before their application has connected.
+ */
+#ifndef LIBNEWRELIC_PENDING_H
+#define LIBNEWRELIC_PENDING_H
+
+#include "nr_app.h"
+#include "nr_txn.h"
+
+/*! @brief The opaque type used to represent the transactions held for an
+ * application that is connecting. */
+typedef struct _newrelic_pending_t newrelic_pending_t;
+
+/*!
+ * @brief Create an empty set of held transactions.
+ *
+ * @param [in] capacity The maximum number of transactions to hold.
+ * @param [in] async_send Whether transactions are handed to the background
+ * sender once the application has connected.
+ *
+ * @return A newly allocated set, or NULL if the capacity is 0.
+ */
+newrelic_pending_t* newrelic_pending_create(size_t capacity, bool async_send);
+
+/*!
+ * @brief Destroy a set of held transactions, discarding any still held.
+ *
+ * @param [in,out] pending_ptr The address of the set, which is set to NULL.
+ */
+void newrelic_pending_destroy(newrelic_pending_t** pending_ptr);
+
+/*!
+ * @brief Hold a transaction until its application has connected.
+ *
+ * @param [in] pending The held transactions.
+ * @param [in] app The application, which is not locked.
+ * @param [in] txn A transaction started with nr_txn_begin_unconnected() and
+ * stopped with nr_txn_end_unconnected().
+ *
+ * The application's state is checked under the same lock that
+ * newrelic_pending_replay() takes, so a transaction is either held and later
+ * replayed, or left with the caller once the application has connected.
+ * Ignored transactions, transactions of an application that will never
+ * connect, and transactions that do not fit are destroyed.
+ *
+ * @return true if the transaction was taken, in which case it must no longer
+ * be used; false if the application has connected, in which case the caller
+ * should complete it with newrelic_pending_connect().
+ */
+bool newrelic_pending_add(newrelic_pending_t* pending,
+                          nrapp_t* app,
+                          nrtxn_t* txn);
+
+/*!
+ * @brief Complete a transaction started before its application connected.
+ *
+ * The application's connect information is applied to the transaction,
+ * which is then ended with nr_txn_end().
+ *
+ * @param [in] app The connected application, which is not locked.
+ * @param [in] txn The transaction.
+ *
+ * @return true if the transaction is ready to be sent; false if the
+ * application is not connected.
+ */
+bool newrelic_pending_connect(nrapp_t* app, nrtxn_t* txn);
+
+/*!
+ * @brief Send the held transactions, if their application has connected.
+ *
+ * If the application has connected, each held transaction is completed with
+ * newrelic_pending_connect() and sent; if the application will never
+ * connect, they are discarded. Otherwise they stay held. The number of
+ * transactions that did not fit is reported with the first one sent, as the
+ * Supportability/C/Startup/Dropped metric. It is safe to call this function
+ * with a NULL set.
+ *
+ * @param [in] pending The held transactions.
+ * @param [in] app The application, which is not locked.
+ */
+void newrelic_pending_replay(newrelic_pending_t* pending, nrapp_t* app);
+
+#endif /* LIBNEWRELIC_PENDING_H */
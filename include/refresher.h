@@ -0,0 +1,57 @@
+/*!
+ * @file refresher.h
+ *
+ * @brief Function declarations necessary to support refreshing application
+ * information from the daemon on a background thread.
+ */
+#ifndef LIBNEWRELIC_REFRESHER_H
+#define LIBNEWRELIC_REFRESHER_H
+
+#include "nr_app.h"
+
+/*! @brief The opaque type used to represent an application refresher. */
+typedef struct _newrelic_refresher_t newrelic_refresher_t;
+
+/*!
+ * @brief The type of the function called by the refresher thread after each
+ * time it considers a query.
+ *
+ * @param [in] app The application, which is not locked.
+ * @param [in] userdata The userdata given to newrelic_refresher_start().
+ */
+typedef void (*newrelic_refresher_callback_t)(nrapp_t* app, void* userdata);
+
+/*!
+ * @brief Start refreshing an application's information in the background.
+ *
+ * The refresher thread queries the daemon about the application whenever
+ * nr_agent_should_do_app_daemon_query() says a query is due, and publishes
+ * the reply under the application lock, so that starting a transaction never
+ * waits on the daemon.
+ *
+ * @param [in] app The application. It must outlive the refresher.
+ * @param [in] callback An optional function to call on the refresher thread
+ * after each query is considered, for example to act on the application
+ * having connected.
+ * @param [in] userdata Passed to the callback.
+ *
+ * @return A newly allocated refresher, or NULL if the thread could not be
+ * started.
+ */
+newrelic_refresher_t* newrelic_refresher_start(
+    nrapp_t* app,
+    newrelic_refresher_callback_t callback,
+    void* userdata);
+
+/*!
+ * @brief Stop and destroy a refresher.
+ *
+ * If a query is in progress, this waits for it to finish. It is safe to call
+ * this function with a NULL refresher.
+ *
+ * @param [in,out] refresher_ptr The address of the refresher, which is set to
+ * NULL.
+ */
+void newrelic_refresher_stop(newrelic_refresher_t** refresher_ptr);
+
+#endif /* LIBNEWRELIC_REFRESHER_H */
@@ -7,17 +7,36 @@
 #define LIBNEWRELIC_SEGMENT_H
 
 #include <stdbool.h>
+#include "nr_segment_buffer.h"
 #include "nr_segment_datastore.h"
 #include "nr_segment_external.h"
 #include "nr_txn.h"
+#include "transaction.h"
 
 typedef struct _newrelic_segment_t {
+  /*! The record of a custom segment recorded into a per-thread buffer. It
+   * must be the first member, as such handles are allocated as records. Its
+   * buffer is NULL for every other segment. */
+  nr_segment_record_t record;
+
+  /*! The axiom segment; NULL for a segment recorded into a per-thread
+   * buffer, and once the segment has been ended, as the segment budget may
+   * then fold it and reuse its memory. */
   nr_segment_t* segment;
   nrtxn_t* transaction;
 
   /*! The lock inherited from the transaction. */
   nrthread_mutex_t* txn_lock;
 
+  /*! The transaction the segment handle was created on; NULL once that
+   * transaction has ended. */
+  newrelic_txn_t* owner;
+
+  /*! The neighbouring handles in the owner's list of live handles. While the
+   * handle is in its owner's free list, next is the next reusable handle. */
+  struct _newrelic_segment_t* prev;
+  struct _newrelic_segment_t* next;
+
   /* Type fields. Which union is valid depends on segment->type, which is the
    * source of truth for what type of segment this is. */
   union {
@@ -48,17 +67,48 @@ typedef struct _newrelic_segment_t {
  * This function ensures that segments are created correctly, particularly
  * around exclusive time calculations.
  *
- * @param [in] txn The transaction to create the segment on.
+ * The segment handle reuses one that has been destroyed on the same
+ * transaction if possible, so that starting a segment does not normally
+ * touch the heap.
+ *
+ * @param [in] transaction The transaction to create the segment on.
  * @return A segment, or NULL if an error occurred.
  *
  * @warning As this is an internal function, a NULL check is _not_ performed on
- *          txn! Additionally, the transaction must be locked before calling
- *          this function.
+ *          transaction! Additionally, the transaction must be locked before
+ *          calling this function.
  */
-extern newrelic_segment_t* newrelic_segment_create(nrtxn_t* txn);
+extern newrelic_segment_t* newrelic_segment_create(
+    newrelic_txn_t* transaction);
 
+/*!
+ * @brief Destroy a segment handle.
+ *
+ * Any type specific fields are freed and the handle is returned to the
+ * transaction it was created on for reuse. If that transaction has ended, the
+ * handle is freed. The handle of a segment recorded into a per-thread buffer
+ * is kept until the transaction is destroyed.
+ *
+ * @param [in,out] segment_ptr The address of the segment handle; it is set to
+ * NULL.
+ *
+ * @warning The transaction the segment was created on must not be locked by
+ *          the caller.
+ */
 extern void newrelic_segment_destroy(newrelic_segment_t** segment_ptr);
 
+/*!
+ * @brief Release the segment handles of a transaction that is ending.
+ *
+ * Reusable handles are freed. Handles that have not been destroyed stay
+ * allocated, as the caller may still end them, but their type specific fields
+ * are freed and they no longer refer to the transaction, so they can only be
+ * destroyed.
+ *
+ * @param [in] transaction The transaction, which must be locked.
+ */
+extern void newrelic_segment_release_all(newrelic_txn_t* transaction);
+
 /*!
  * @brief Validate segment parameter.
  *
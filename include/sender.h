@@ -0,0 +1,64 @@
+/*!
+ * @file sender.h
+ *
+ * @brief Function declarations necessary to support sending finished
+ * transactions to the daemon from a background thread.
+ */
+#ifndef LIBNEWRELIC_SENDER_H
+#define LIBNEWRELIC_SENDER_H
+
+#include "libnewrelic.h"
+#include "nr_txn.h"
+
+/*!
+ * @brief Start the background sender.
+ *
+ * The sender is process-wide: if it is already running, this function only
+ * counts another user of it, and the existing queue size is kept. Each
+ * successful call must be matched by a call to newrelic_sender_release().
+ *
+ * @param [in] config The sender configuration.
+ *
+ * @return true if the sender is running; false otherwise.
+ */
+bool newrelic_sender_start(const newrelic_sender_config_t* config);
+
+/*!
+ * @brief Queue a finished transaction to be sent to the daemon.
+ *
+ * @param [in] txn The transaction. It must already have been ended with
+ * nr_txn_end().
+ *
+ * If the queue is full, the sender's drop policy decides which transaction
+ * is dropped, and the drop is reported as a Supportability metric with a
+ * later transaction. Under NEWRELIC_DROP_NONE nothing is dropped, and the
+ * transaction is left with the caller.
+ *
+ * @return true if the sender has taken the transaction, in which case it
+ * will destroy it once it has been sent or dropped; false if the sender is
+ * not running, or the queue is full and the drop policy is
+ * NEWRELIC_DROP_NONE, in which case the caller still owns it.
+ */
+bool newrelic_sender_enqueue(nrtxn_t* txn);
+
+/*!
+ * @brief Give up one user's hold on the background sender.
+ *
+ * The sender is stopped, as by newrelic_sender_stop(), once every user that
+ * started it has released it.
+ */
+void newrelic_sender_release(void);
+
+/*!
+ * @brief Stop the background sender.
+ *
+ * The sender is stopped regardless of how many users still hold it. Any
+ * transactions still in the queue are sent before the sender thread exits.
+ * Drops not yet reported with a transaction are then sent as Supportability
+ * metrics of their own, under the agent run of the last transaction sent,
+ * or logged if that is not possible.
+ * It is safe to call this function if the sender was never started.
+ */
+void newrelic_sender_stop(void);
+
+#endif /* LIBNEWRELIC_SENDER_H */
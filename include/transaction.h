@@ -6,7 +6,11 @@
 #ifndef LIBNEWRELIC_TRANSACTION_H
 #define LIBNEWRELIC_TRANSACTION_H
 
+#include "libnewrelic.h"
+#include "nr_app.h"
+#include "nr_metric_aggregate.h"
 #include "nr_txn.h"
+#include "pending.h"
 #include "util_threads.h"
 
 /*!
@@ -18,6 +22,32 @@ typedef struct _newrelic_txn_t {
 
   /*! The transaction lock. */
   nrthread_mutex_t lock;
+
+  /*! Whether the finished transaction is handed to the background sender. */
+  bool async_send;
+
+  /*! Where the transaction is held if it ends before its application has
+   * connected; NULL if it started once the application had connected. */
+  newrelic_pending_t* pending;
+
+  /*! The application the transaction belongs to, if pending is set. */
+  nrapp_t* app;
+
+  /*! The application the transaction was started on. */
+  const newrelic_app_t* owner;
+
+  /*! Segment handles that have been created and not yet destroyed.
+   * Protected by the transaction lock. */
+  struct _newrelic_segment_t* live_segments;
+
+  /*! Segment handles that have been ended and can be reused. Protected by
+   * the transaction lock. */
+  struct _newrelic_segment_t* free_segments;
+
+  /*! Where the transaction's metrics are merged when it ends, if its
+   * application aggregates metrics and it started connected; NULL
+   * otherwise. */
+  nr_metric_aggregate_t* metric_aggregate;
 } newrelic_txn_t;
 
 /*!
@@ -35,4 +65,19 @@ newrelic_txn_t* newrelic_start_transaction(newrelic_app_t* app,
                                            const char* name,
                                            bool is_web_transaction);
 
+/*!
+ * @brief Send an ended transaction to the daemon and destroy it.
+ *
+ * @param [in,out] txn_ptr The address of the transaction, which has been
+ * ended with nr_txn_end(); it is set to NULL.
+ * @param [in] async_send Whether to hand the transaction to the background
+ * sender. If the sender does not take it, it is sent from this thread.
+ *
+ * Ignored transactions are destroyed without being sent.
+ *
+ * @return false if the transaction could not be written to the daemon; true
+ * otherwise.
+ */
+bool newrelic_send_transaction(nrtxn_t** txn_ptr, bool async_send);
+
 #endif /* LIBNEWRELIC_TRANSACTION_H */
@@ -1,12 +1,76 @@
 #include "libnewrelic.h"
 #include "app.h"
 #include "global.h"
+#include "sender.h"
 
 #include "nr_agent.h"
 #include "util_logging.h"
 #include "util_memory.h"
 #include "util_strings.h"
 
+/*
+ * How often metrics recorded outside of any transaction are sent, if the
+ * application does not aggregate transaction metrics.
+ */
+#define NEWRELIC_APP_METRICS_INTERVAL_MS 5000
+
+static void newrelic_app_refresh(nrapp_t* app, void* userdata) {
+  newrelic_app_t* sdk_app = (newrelic_app_t*)userdata;
+
+  newrelic_pending_replay(sdk_app->pending, app);
+  newrelic_app_send_metrics(sdk_app, false);
+}
+
+void newrelic_app_send_metrics(newrelic_app_t* app, bool force) {
+  nrtime_t interval;
+  nrtime_t now;
+  char* agent_run_id = NULL;
+  bool due;
+
+  if (NULL == app) {
+    return;
+  }
+
+  now = nr_get_time();
+  nrt_mutex_lock(&app->lock);
+  interval = NEWRELIC_APP_METRICS_INTERVAL_MS;
+  if (app->config && app->config->sender.metric_aggregation_ms) {
+    interval = app->config->sender.metric_aggregation_ms;
+  }
+  due = force || (now >= app->metrics_sent + interval * NR_TIME_DIVISOR_MS);
+  if (due) {
+    app->metrics_sent = now;
+  }
+  nrt_mutex_unlock(&app->lock);
+
+  if (!due) {
+    return;
+  }
+
+  if (app->metric_aggregate
+      && (NR_FAILURE
+          == nr_metric_aggregate_tx(app->metric_aggregate,
+                                    nr_get_daemon_fd()))) {
+    nrl_error(NRL_INSTRUMENT, "failed to send aggregated metrics");
+  }
+
+  /* Metrics recorded before the application connects are kept until it has. */
+  if (app->app) {
+    nrt_mutex_lock(&app->app->app_lock);
+    if (app->app->agent_run_id) {
+      agent_run_id = nr_strdup(app->app->agent_run_id);
+    }
+    nrt_mutex_unlock(&app->app->app_lock);
+  }
+
+  if (NR_FAILURE
+      == nr_metric_accumulator_tx(app->metric_accumulator, agent_run_id,
+                                  nr_get_daemon_fd())) {
+    nrl_error(NRL_INSTRUMENT, "failed to send application metrics");
+  }
+  nr_free(agent_run_id);
+}
+
 newrelic_app_t* newrelic_create_app(const newrelic_app_config_t* given_config,
                                     unsigned short timeout_ms) {
   newrelic_app_t* app;
@@ -40,6 +104,8 @@ newrelic_app_t* newrelic_create_app(const newrelic_app_config_t* given_config,
   config->transaction_tracer = given_config->transaction_tracer;
   config->distributed_tracing.enabled = given_config->distributed_tracing.enabled;
   config->span_events.enabled = given_config->span_events.enabled;
+  config->sender = given_config->sender;
+  config->startup = given_config->startup;
 
   app_info = (nr_app_info_t*)nr_zalloc(sizeof(nr_app_info_t));
 
@@ -62,6 +128,17 @@ newrelic_app_t* newrelic_create_app(const newrelic_app_config_t* given_config,
   app->app_info = app_info;
   app->config = config;
 
+  if (config->startup.async) {
+    app->pending = newrelic_pending_create(
+        (size_t)config->startup.pending_transactions, config->sender.async);
+  }
+
+  if (0 != config->sender.metric_aggregation_ms) {
+    app->metric_aggregate = nr_metric_aggregate_create();
+  }
+  app->metric_accumulator = nr_metric_accumulator_create();
+  app->metrics_sent = nr_get_time();
+
   if (NR_FAILURE == newrelic_connect_app(app, timeout_ms)) {
     /* There should already be an error message printed */
     nrl_close_log_file();
@@ -69,6 +146,61 @@ newrelic_app_t* newrelic_create_app(const newrelic_app_config_t* given_config,
     return NULL;
   }
 
+  /* A zeroed configuration leaves the connection count unchanged. */
+  if ((0 != config->sender.daemon_connections)
+      && (NR_FAILURE
+          == nr_agent_set_daemon_connection_count(
+              (int)config->sender.daemon_connections))) {
+    nrl_warning(NRL_INSTRUMENT,
+                "invalid number of daemon connections %u; keeping %d",
+                config->sender.daemon_connections,
+                nr_agent_get_daemon_connection_count());
+  }
+
+  if (NR_FAILURE
+      == nr_agent_set_daemon_shm_ring_capacity(
+          (size_t)config->sender.shared_memory_size)) {
+    nrl_warning(NRL_INSTRUMENT,
+                "invalid shared memory size %u; transactions will be sent "
+                "over the daemon socket",
+                config->sender.shared_memory_size);
+    nr_agent_set_daemon_shm_ring_capacity(0);
+  }
+
+  if ((0 != config->sender.spool_size)
+      && ('\0' != config->sender.spool_filename[0])
+      && (NR_FAILURE
+          == nr_agent_set_daemon_spool(config->sender.spool_filename,
+                                       (size_t)config->sender.spool_size))) {
+    nrl_warning(NRL_INSTRUMENT,
+                "unable to use spool file %s of %u bytes; transactions that "
+                "end while the daemon is unreachable will be lost",
+                config->sender.spool_filename, config->sender.spool_size);
+  }
+
+  if (config->sender.async) {
+    app->sender_started = newrelic_sender_start(&config->sender);
+    if (!app->sender_started) {
+      nrl_warning(NRL_INSTRUMENT,
+                  "unable to start the transaction sender; transactions will "
+                  "be sent synchronously");
+    }
+  }
+
+  /*
+   * Later appinfo queries happen on the refresher thread, rather than on the
+   * threads starting transactions. Transactions held while the application
+   * connects, and metrics recorded outside of them, are sent from there
+   * too.
+   */
+  app->refresher
+      = newrelic_refresher_start(app->app, newrelic_app_refresh, app);
+  if (NULL == app->refresher) {
+    nrl_warning(NRL_INSTRUMENT,
+                "unable to start the application refresher; application "
+                "information will be refreshed when transactions start");
+  }
+
   return app;
 }
 
@@ -79,6 +211,20 @@ bool newrelic_destroy_app(newrelic_app_t** app) {
 
   nrl_info(NRL_INSTRUMENT, "newrelic shutting down");
 
+  newrelic_refresher_stop(&(*app)->refresher);
+  newrelic_pending_destroy(&(*app)->pending);
+
+  /*
+   * Queued transactions are flushed before the daemon connection is closed.
+   * The sender is shared, so it only stops once no other application holds
+   * it.
+   */
+  if ((*app)->sender_started) {
+    newrelic_sender_release();
+    (*app)->sender_started = false;
+  }
+  newrelic_app_send_metrics(*app, true);
+
   nrt_mutex_lock(&(*app)->lock);
   {
     nr_agent_close_daemon_connection();
@@ -90,6 +236,10 @@ bool newrelic_destroy_app(newrelic_app_t** app) {
     if ((*app)->config) {
       newrelic_destroy_app_config(&((*app)->config));
     }
+
+    nr_hashmap_destroy(&(*app)->metric_handles);
+    nr_metric_aggregate_destroy(&(*app)->metric_aggregate);
+    nr_metric_accumulator_destroy(&(*app)->metric_accumulator);
   }
   nrt_mutex_unlock(&(*app)->lock);
 
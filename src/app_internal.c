@@ -7,6 +7,7 @@
 #include "app.h"
 
 #include "nr_agent.h"
+#include "nr_app_cache.h"
 #include "util_logging.h"
 #include "util_sleep.h"
 
@@ -25,17 +26,43 @@ nr_status_t newrelic_connect_app(newrelic_app_t* app,
     return NR_FAILURE;
   }
 
-  nrapp = nr_agent_find_or_add_app(nr_agent_applist, app->app_info, NULL,
-                                   timeout_time);
+  /*
+   * Applications that connect in the background are queried about by their
+   * refresher. So are applications started from cached connect information,
+   * which the refresher confirms.
+   */
+  if (app->config
+      && (app->config->startup.async
+          || ('\0' != app->config->startup.cache_filename[0]))) {
+    nrapp = nr_agent_find_or_add_app_nowait(nr_agent_applist, app->app_info,
+                                            NULL);
+    if (nrapp && ('\0' != app->config->startup.cache_filename[0])) {
+      nr_app_set_cache(nrapp, app->config->startup.cache_filename);
+    }
+    if (nrapp && !app->config->startup.async && (NR_APP_OK != nrapp->state)) {
+      /* Nothing usable was cached: wait for the connection as usual. */
+      nrt_mutex_unlock(&nrapp->app_lock);
+      nrapp = nr_agent_find_or_add_app(nr_agent_applist, app->app_info, NULL,
+                                       timeout_time);
+    }
+  } else {
+    nrapp = nr_agent_find_or_add_app(nr_agent_applist, app->app_info, NULL,
+                                     timeout_time);
+  }
   if (NULL == nrapp) {
     nrl_error(NRL_INSTRUMENT, "application was unable to connect");
     return NR_FAILURE;
   }
 
   app->app = nrapp;
+  if (NR_APP_OK == nrapp->state) {
+    nrl_info(NRL_INSTRUMENT, "application %s connected",
+             NRSAFESTR(app->app_info->appname));
+  } else {
+    nrl_info(NRL_INSTRUMENT, "application %s connecting in the background",
+             NRSAFESTR(app->app_info->appname));
+  }
   nrt_mutex_unlock(&app->app->app_lock);
-  nrl_info(NRL_INSTRUMENT, "application %s connected",
-           NRSAFESTR(app->app_info->appname));
   nrt_mutex_init(&app->lock, 0);
 
   return NR_SUCCESS;
@@ -56,6 +56,27 @@ newrelic_app_config_t* newrelic_create_app_config(const char* app_name,
   config->distributed_tracing.enabled = false;
   config->span_events.enabled = true;
 
+  /* Set up the default transaction sender configuration */
+  config->sender.async = false;
+  config->sender.queue_size = 1000;
+  config->sender.drop_policy = NEWRELIC_DROP_NONE;
+  config->sender.batch_size = 1;
+  config->sender.batch_timeout_ms = 100;
+  config->sender.daemon_connections = 1;
+  config->sender.shared_memory_size = 0;
+  config->sender.spool_filename[0] = '\0';
+  config->sender.spool_size = 0;
+  config->sender.metric_aggregation_ms = 0;
+
+  /* Set up the default application startup configuration */
+  config->startup.async = false;
+  config->startup.pending_transactions = 1000;
+  config->startup.cache_filename[0] = '\0';
+
+  /* Set up the default segment configuration */
+  config->segments.thread_buffers = false;
+  config->segments.max_segments = 0;
+
   return config;
 }
 
@@ -125,6 +146,8 @@ nrtxnopt_t* newrelic_get_transaction_options(
     opt->distributed_tracing_enabled = config->distributed_tracing.enabled;
     opt->span_events_enabled = config->span_events.enabled;
 
+    opt->max_segments = config->segments.max_segments;
+
     if (NEWRELIC_THRESHOLD_IS_APDEX_FAILING
         == config->transaction_tracer.threshold) {
       opt->tt_is_apdex_f = 1;
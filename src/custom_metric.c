@@ -1,8 +1,15 @@
+#include <math.h>
 #include <stdio.h>
 #include "libnewrelic.h"
+#include "app.h"
+#include "custom_metric.h"
 #include "nr_txn.h"
 #include "transaction.h"
 
+#include "util_logging.h"
+#include "util_memory.h"
+#include "util_strings.h"
+
 bool newrelic_record_custom_metric(newrelic_txn_t* transaction,
                                    const char* metric_name,
                                    double milliseconds) {
@@ -20,3 +27,114 @@ bool newrelic_record_custom_metric(newrelic_txn_t* transaction,
 
   return (NR_SUCCESS == ret);
 }
+
+bool newrelic_record_distribution_metric(newrelic_txn_t* transaction,
+                                         const char* metric_name,
+                                         double milliseconds) {
+  nr_status_t ret;
+
+  if (NULL == transaction || NULL == metric_name) {
+    return false;
+  }
+
+  nrt_mutex_lock(&transaction->lock);
+  {
+    ret = nr_txn_add_distribution_metric(transaction->txn, metric_name,
+                                         milliseconds);
+  }
+  nrt_mutex_unlock(&transaction->lock);
+
+  return (NR_SUCCESS == ret);
+}
+
+bool newrelic_record_app_metric(newrelic_app_t* app,
+                                const char* metric_name,
+                                double milliseconds) {
+  if (NULL == app || NULL == metric_name) {
+    return false;
+  }
+
+  if (isnan(milliseconds) || isinf(milliseconds)) {
+    nrl_warning(NRL_API, "unable to add application metric '%s': invalid value",
+                metric_name);
+    return false;
+  }
+
+  return (NR_SUCCESS
+          == nr_metric_accumulator_add(
+              app->metric_accumulator, metric_name,
+              (nrtime_t)(NR_TIME_DIVISOR_MS_D * milliseconds)));
+}
+
+void newrelic_metric_handle_destroy(void* handle) {
+  newrelic_metric_handle_t* metric = (newrelic_metric_handle_t*)handle;
+
+  if (NULL == metric) {
+    return;
+  }
+
+  nr_free(metric->name);
+  nr_free(metric);
+}
+
+newrelic_metric_handle_t* newrelic_register_custom_metric(
+    newrelic_app_t* app,
+    const char* metric_name) {
+  newrelic_metric_handle_t* handle;
+  size_t name_len;
+
+  if (NULL == app || NULL == metric_name) {
+    return NULL;
+  }
+
+  name_len = nr_strlen(metric_name);
+
+  nrt_mutex_lock(&app->lock);
+  {
+    if (NULL == app->metric_handles) {
+      app->metric_handles = nr_hashmap_create(newrelic_metric_handle_destroy);
+    }
+
+    handle = (newrelic_metric_handle_t*)nr_hashmap_get(app->metric_handles,
+                                                       metric_name, name_len);
+    if (NULL == handle) {
+      handle = (newrelic_metric_handle_t*)nr_zalloc(
+          sizeof(newrelic_metric_handle_t));
+      handle->name = nr_strdup(metric_name);
+      handle->slot = nr_hashmap_count(app->metric_handles);
+      handle->app = app;
+      nr_hashmap_set(app->metric_handles, metric_name, name_len, handle);
+    }
+  }
+  nrt_mutex_unlock(&app->lock);
+
+  return handle;
+}
+
+bool newrelic_record_custom_metric_handle(
+    newrelic_txn_t* transaction,
+    const newrelic_metric_handle_t* handle,
+    double milliseconds) {
+  nr_status_t ret;
+
+  if (NULL == transaction || NULL == handle) {
+    return false;
+  }
+
+  if (transaction->owner != handle->app) {
+    nrl_error(NRL_API,
+              "unable to record custom metric '%s': the metric was registered "
+              "with a different application to the transaction's",
+              handle->name);
+    return false;
+  }
+
+  nrt_mutex_lock(&transaction->lock);
+  {
+    ret = nr_txn_add_custom_metric_slot(transaction->txn, handle->slot,
+                                        handle->name, milliseconds);
+  }
+  nrt_mutex_unlock(&transaction->lock);
+
+  return (NR_SUCCESS == ret);
+}
@@ -9,45 +9,41 @@
 #include "util_sql.h"
 #include "util_strings.h"
 
-newrelic_segment_t* newrelic_start_datastore_segment(
-    newrelic_txn_t* transaction,
+bool newrelic_validate_datastore_segment_params(
     const newrelic_datastore_segment_params_t* params) {
-  nr_datastore_t ds_type = NR_DATASTORE_OTHER;
-  newrelic_segment_t* segment = NULL;
-
-  /* Affirm required function parameters and datastore parameters are not
-   * NULL */
-  if (NULL == transaction) {
-    nrl_error(NRL_INSTRUMENT,
-              "cannot start a datastore segment on a NULL transaction");
-    return NULL;
-  }
+  /* Affirm the datastore parameters are not NULL */
   if (NULL == params) {
     nrl_error(NRL_INSTRUMENT, "params cannot be NULL");
-    return NULL;
+    return false;
   }
   if (NULL == params->product) {
     nrl_error(NRL_INSTRUMENT, "product param cannot be NULL");
-    return NULL;
+    return false;
   }
 
   /* Perform slash validation on product, collection, operation, and host */
   if (!newrelic_validate_segment_param(params->product, "product")) {
-    return NULL;
+    return false;
   }
   if (!newrelic_validate_segment_param(params->collection, "collection")) {
-    return NULL;
+    return false;
   }
   if (!newrelic_validate_segment_param(params->operation, "operation")) {
-    return NULL;
+    return false;
   }
   if (!newrelic_validate_segment_param(params->host, "host")) {
-    return NULL;
+    return false;
   }
 
+  return true;
+}
+
+void newrelic_init_datastore_segment(
+    newrelic_segment_t* segment,
+    const newrelic_datastore_segment_params_t* params) {
   /* Get the datastore product type, since we need it to figure out SQL
    * behaviour. */
-  ds_type = nr_datastore_from_string(params->product);
+  nr_datastore_t ds_type = nr_datastore_from_string(params->product);
 
   /* If the ds_type is the default, log that the datastore segment has
    * been created for an unsupported datastore product. Logging this fact here
@@ -56,49 +52,65 @@ newrelic_segment_t* newrelic_start_datastore_segment(
     nrl_info(NRL_INSTRUMENT, "instrumenting unsupported datastore product");
   }
 
+  /* Set the type of the segment here; when the user ends the segment
+   * this value is used to affirm that newrelic_end_datastore_segment is used
+   * only on a datastore segment. */
+  segment->segment->type = NR_SEGMENT_DATASTORE;
+
+  segment->type.datastore.collection
+      = nr_strdup_or(params->collection, "other");
+  segment->type.datastore.operation = nr_strdup_or(params->operation, "other");
+
+  /* Axiom uses the product supplied by the customer whenever the type is
+   * NR_DATASTORE_OTHER */
+  segment->type.datastore.type = ds_type;
+
+  /* While it is type-safe to allow an empty-string product parameter, having
+   * such mangles some of the New Relic UI.  Check for an empty string and
+   * replace it with a sensible default. Otherwise, copy over the supplied
+   * product */
+  segment->type.datastore.string = nr_strempty(params->product)
+                                       ? nr_strdup(NEWRELIC_DATASTORE_OTHER)
+                                       : nr_strdup(params->product);
+
+  segment->type.datastore.sql = params->query ? nr_strdup(params->query) : NULL;
+
+  /* Build out the appropriate nr_datastore_instance_t.  The axiom calls do
+   * the work of taking care that a NULL port_or_path_id value is set to its
+   * default value, "unknown" */
+  nr_datastore_instance_set_host(&segment->type.datastore.instance,
+                                 params->host);
+  nr_datastore_instance_set_port_path_or_id(&segment->type.datastore.instance,
+                                            params->port_path_or_id);
+  nr_datastore_instance_set_database_name(&segment->type.datastore.instance,
+                                          params->database_name);
+}
+
+newrelic_segment_t* newrelic_start_datastore_segment(
+    newrelic_txn_t* transaction,
+    const newrelic_datastore_segment_params_t* params) {
+  newrelic_segment_t* segment = NULL;
+
+  /* Affirm required function parameters and datastore parameters are valid */
+  if (NULL == transaction) {
+    nrl_error(NRL_INSTRUMENT,
+              "cannot start a datastore segment on a NULL transaction");
+    return NULL;
+  }
+  if (!newrelic_validate_datastore_segment_params(params)) {
+    return NULL;
+  }
+
   /* Actually start the segment. */
   nrt_mutex_lock(&transaction->lock);
   {
     /* Set up the C SDK wrapper struct. */
-    segment = newrelic_segment_create(transaction->txn);
+    segment = newrelic_segment_create(transaction);
     if (NULL == segment) {
       goto unlock_and_end;
     }
 
-    /* Set the type of the segment here; when the user ends the segment
-     * this value is used to affirm that newrelic_end_datastore_segment is used
-     * only on a datastore segment. */
-    segment->segment->type = NR_SEGMENT_DATASTORE;
-
-    segment->type.datastore.collection
-        = nr_strdup_or(params->collection, "other");
-    segment->type.datastore.operation
-        = nr_strdup_or(params->operation, "other");
-
-    /* Axiom uses the product supplied by the customer whenever the type is
-     * NR_DATASTORE_OTHER */
-    segment->type.datastore.type = ds_type;
-
-    /* While it is type-safe to allow an empty-string product parameter, having
-     * such mangles some of the New Relic UI.  Check for an empty string and
-     * replace it with a sensible default. Otherwise, copy over the supplied
-     * product */
-    segment->type.datastore.string = nr_strempty(params->product)
-                                         ? nr_strdup(NEWRELIC_DATASTORE_OTHER)
-                                         : nr_strdup(params->product);
-
-    segment->type.datastore.sql
-        = params->query ? nr_strdup(params->query) : NULL;
-
-    /* Build out the appropriate nr_datastore_instance_t.  The axiom calls do
-     * the work of taking care that a NULL port_or_path_id value is set to its
-     * default value, "unknown" */
-    nr_datastore_instance_set_host(&segment->type.datastore.instance,
-                                   params->host);
-    nr_datastore_instance_set_port_path_or_id(&segment->type.datastore.instance,
-                                              params->port_path_or_id);
-    nr_datastore_instance_set_database_name(&segment->type.datastore.instance,
-                                            params->database_name);
+    newrelic_init_datastore_segment(segment, params);
 
   unlock_and_end:;
   }
@@ -31,6 +31,12 @@ char* newrelic_create_distributed_trace_payload(newrelic_txn_t* transaction,
     s = segment->segment;
   }
 
+  /* Segments recorded into per-thread buffers have no span until the
+   * transaction ends, so their payloads refer to the root segment. */
+  if (NULL == s) {
+    s = transaction->txn->segment_root;
+  }
+
   payload = nr_txn_create_distributed_trace_payload(transaction->txn, s);
   nrt_mutex_unlock(&transaction->lock);
 
@@ -8,51 +8,66 @@
 #include "util_strings.h"
 #include "util_url.h"
 
-newrelic_segment_t* newrelic_start_external_segment(
-    newrelic_txn_t* transaction,
+bool newrelic_validate_external_segment_params(
     const newrelic_external_segment_params_t* params) {
-  newrelic_segment_t* segment = NULL;
-
-  /* Validate our inputs. */
-  if (NULL == transaction) {
-    nrl_error(NRL_INSTRUMENT,
-              "cannot start an external segment on a NULL transaction");
-    return NULL;
-  }
-
   if (NULL == params) {
     nrl_error(NRL_INSTRUMENT, "params cannot be NULL");
-    return NULL;
+    return false;
   }
 
   if (!newrelic_validate_segment_param(params->library, "library")) {
-    return NULL;
+    return false;
   }
 
   if (!newrelic_validate_segment_param(params->procedure, "procedure")) {
-    return NULL;
+    return false;
   }
 
   if (NULL == params->uri) {
     nrl_error(NRL_INSTRUMENT, "uri cannot be NULL");
+    return false;
+  }
+
+  return true;
+}
+
+void newrelic_init_external_segment(
+    newrelic_segment_t* segment,
+    const newrelic_external_segment_params_t* params) {
+  segment->segment->type = NR_SEGMENT_EXTERNAL;
+
+  /* Save the supplied parameters until the external segment is ended */
+  segment->type.external.uri = params->uri ? nr_strdup(params->uri) : NULL;
+  segment->type.external.library
+      = params->library ? nr_strdup(params->library) : NULL;
+  segment->type.external.procedure
+      = params->procedure ? nr_strdup(params->procedure) : NULL;
+}
+
+newrelic_segment_t* newrelic_start_external_segment(
+    newrelic_txn_t* transaction,
+    const newrelic_external_segment_params_t* params) {
+  newrelic_segment_t* segment = NULL;
+
+  /* Validate our inputs. */
+  if (NULL == transaction) {
+    nrl_error(NRL_INSTRUMENT,
+              "cannot start an external segment on a NULL transaction");
+    return NULL;
+  }
+
+  if (!newrelic_validate_external_segment_params(params)) {
     return NULL;
   }
 
   nrt_mutex_lock(&transaction->lock);
   {
-    segment = newrelic_segment_create(transaction->txn);
+    segment = newrelic_segment_create(transaction);
     if (NULL == segment) {
       goto unlock_and_end;
     }
 
-    segment->segment->type = NR_SEGMENT_EXTERNAL;
-
-    /* Save the supplied parameters until the external segment is ended */
-    segment->type.external.uri = params->uri ? nr_strdup(params->uri) : NULL;
-    segment->type.external.library
-        = params->library ? nr_strdup(params->library) : NULL;
-    segment->type.external.procedure
-        = params->procedure ? nr_strdup(params->procedure) : NULL;
+    newrelic_init_external_segment(segment, params);
 
   unlock_and_end:;
   }
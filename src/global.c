@@ -1,7 +1,9 @@
 #include "libnewrelic.h"
 #include "global.h"
+#include "sender.h"
 
 #include "nr_agent.h"
+#include "nr_txn.h"
 #include "util_logging.h"
 #include "util_memory.h"
 #include "util_sleep.h"
@@ -111,8 +113,10 @@ bool newrelic_ensure_init(void) {
 }
 
 void newrelic_shutdown(void) {
+  newrelic_sender_stop();
   nr_agent_close_daemon_connection();
   nr_applist_destroy(&nr_agent_applist);
+  nr_txn_recycle_clear();
   nrl_close_log_file();
   newrelic_log_configured = false;
 }
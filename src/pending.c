@@ -0,0 +1,202 @@
+#include "libnewrelic.h"
+#include "pending.h"
+#include "transaction.h"
+
+#include "util_logging.h"
+#include "util_memory.h"
+#include "util_metrics.h"
+#include "util_threads.h"
+
+#define NEWRELIC_PENDING_DROPPED "Supportability/C/Startup/Dropped"
+
+/*
+ * The transactions that ended before their application connected, in the
+ * order they ended, protected by the mutex. Transactions that did not fit are
+ * counted in dropped until they are reported.
+ */
+struct _newrelic_pending_t {
+  nrthread_mutex_t mutex;
+  nrtxn_t** txns;
+  size_t capacity;
+  size_t count;
+  uint64_t dropped;
+  bool async_send;
+};
+
+newrelic_pending_t* newrelic_pending_create(size_t capacity, bool async_send) {
+  newrelic_pending_t* pending;
+
+  if (0 == capacity) {
+    return NULL;
+  }
+
+  pending = (newrelic_pending_t*)nr_zalloc(sizeof(newrelic_pending_t));
+  nrt_mutex_init(&pending->mutex, 0);
+  pending->txns = (nrtxn_t**)nr_calloc(capacity, sizeof(nrtxn_t*));
+  pending->capacity = capacity;
+  pending->async_send = async_send;
+
+  return pending;
+}
+
+void newrelic_pending_destroy(newrelic_pending_t** pending_ptr) {
+  newrelic_pending_t* pending;
+  size_t i;
+
+  if ((NULL == pending_ptr) || (NULL == *pending_ptr)) {
+    return;
+  }
+
+  pending = *pending_ptr;
+
+  if (pending->count) {
+    nrl_warning(NRL_INSTRUMENT,
+                "discarding %zu transactions that ended before the "
+                "application connected",
+                pending->count);
+  }
+
+  for (i = 0; i < pending->count; i++) {
+    nr_txn_destroy(&pending->txns[i]);
+  }
+
+  nr_free(pending->txns);
+  nrt_mutex_destroy(&pending->mutex);
+  nr_realfree((void**)pending_ptr);
+}
+
+static nrapptype_t newrelic_pending_app_state(nrapp_t* app) {
+  nrapptype_t state;
+
+  nrt_mutex_lock(&app->app_lock);
+  state = app->state;
+  nrt_mutex_unlock(&app->app_lock);
+
+  return state;
+}
+
+bool newrelic_pending_add(newrelic_pending_t* pending,
+                          nrapp_t* app,
+                          nrtxn_t* txn) {
+  nrapptype_t state;
+
+  if ((NULL == pending) || (NULL == app) || (NULL == txn)) {
+    return false;
+  }
+
+  nrt_mutex_lock(&pending->mutex);
+
+  state = newrelic_pending_app_state(app);
+  if (NR_APP_OK == state) {
+    nrt_mutex_unlock(&pending->mutex);
+    return false;
+  }
+
+  if (txn->status.ignore || (NR_APP_INVALID == state)) {
+    nr_txn_destroy(&txn);
+  } else if (pending->count == pending->capacity) {
+    pending->dropped += 1;
+    nr_txn_destroy(&txn);
+  } else {
+    pending->txns[pending->count] = txn;
+    pending->count += 1;
+  }
+
+  nrt_mutex_unlock(&pending->mutex);
+
+  return true;
+}
+
+bool newrelic_pending_connect(nrapp_t* app, nrtxn_t* txn) {
+  nr_status_t st;
+
+  if ((NULL == app) || (NULL == txn)) {
+    return false;
+  }
+
+  nrt_mutex_lock(&app->app_lock);
+  st = nr_txn_apply_connect_info(txn, app);
+  nrt_mutex_unlock(&app->app_lock);
+
+  if (NR_SUCCESS != st) {
+    return false;
+  }
+
+  /* nr_txn_end() locks the application itself. */
+  nr_txn_end(txn);
+
+  return true;
+}
+
+void newrelic_pending_replay(newrelic_pending_t* pending, nrapp_t* app) {
+  nrtxn_t** txns;
+  size_t count;
+  uint64_t dropped;
+  nrapptype_t state;
+  size_t i;
+
+  if ((NULL == pending) || (NULL == app)) {
+    return;
+  }
+
+  nrt_mutex_lock(&pending->mutex);
+  if (0 == pending->count) {
+    nrt_mutex_unlock(&pending->mutex);
+    return;
+  }
+
+  state = newrelic_pending_app_state(app);
+  if (NR_APP_UNKNOWN == state) {
+    nrt_mutex_unlock(&pending->mutex);
+    return;
+  }
+
+  /*
+   * Detach the held transactions, so that they are sent without the lock
+   * held. None are added while the application's state is known.
+   */
+  txns = pending->txns;
+  count = pending->count;
+  dropped = pending->dropped;
+  pending->txns = (nrtxn_t**)nr_calloc(pending->capacity, sizeof(nrtxn_t*));
+  pending->count = 0;
+  pending->dropped = 0;
+  nrt_mutex_unlock(&pending->mutex);
+
+  if (NR_APP_INVALID == state) {
+    nrl_warning(NRL_INSTRUMENT,
+                "discarding %zu transactions that ended before the "
+                "application failed to connect",
+                count);
+  } else {
+    nrl_debug(NRL_INSTRUMENT,
+              "sending %zu transactions that ended before the application "
+              "connected",
+              count);
+    if (dropped) {
+      nrl_warning(NRL_INSTRUMENT,
+                  "%llu transactions ended while too many were waiting for "
+                  "the application to connect, and were discarded",
+                  (unsigned long long)dropped);
+    }
+  }
+
+  for (i = 0; i < count; i++) {
+    nrtxn_t* txn = txns[i];
+
+    if ((NR_APP_OK != state) || !newrelic_pending_connect(app, txn)) {
+      nr_txn_destroy(&txn);
+      continue;
+    }
+
+    if (dropped) {
+      nrm_add_internal(1, txn->unscoped_metrics, NEWRELIC_PENDING_DROPPED,
+                       (nrtime_t)dropped, 0, 0, 0, 0, 0);
+      dropped = 0;
+    }
+
+    newrelic_send_transaction(&txn, pending->async_send);
+  }
+
+  nr_free(txns);
+}
@@ -0,0 +1,104 @@
+#include "libnewrelic.h"
+#include "refresher.h"
+
+#include <time.h>
+
+#include "nr_agent.h"
+#include "util_logging.h"
+#include "util_memory.h"
+#include "util_threads.h"
+#include "util_time.h"
+
+/*
+ * How often the refresher wakes up to consider a query. The query periods
+ * themselves are decided by nr_agent_should_do_app_daemon_query(), and are
+ * measured in whole seconds.
+ */
+#define NEWRELIC_REFRESHER_TICK_MS 1000
+
+struct _newrelic_refresher_t {
+  nrapp_t* app;
+  newrelic_refresher_callback_t callback;
+  void* userdata;
+  nrthread_mutex_t mutex;
+  nrthread_cond_t wake;
+  nrthread_t thread;
+  bool stopping;
+};
+
+static void* newrelic_refresher_main(void* arg) {
+  newrelic_refresher_t* refresher = (newrelic_refresher_t*)arg;
+
+  nrt_mutex_lock(&refresher->mutex);
+  while (!refresher->stopping) {
+    nrt_mutex_unlock(&refresher->mutex);
+    nr_app_refresh_appinfo(refresher->app, time(0));
+    if (refresher->callback) {
+      (refresher->callback)(refresher->app, refresher->userdata);
+    }
+    nrt_mutex_lock(&refresher->mutex);
+
+    if (!refresher->stopping) {
+      nrt_cond_timedwait(
+          &refresher->wake, &refresher->mutex,
+          nr_get_time() + NEWRELIC_REFRESHER_TICK_MS * NR_TIME_DIVISOR_MS);
+    }
+  }
+  nrt_mutex_unlock(&refresher->mutex);
+
+  return NULL;
+}
+
+newrelic_refresher_t* newrelic_refresher_start(
+    nrapp_t* app,
+    newrelic_refresher_callback_t callback,
+    void* userdata) {
+  newrelic_refresher_t* refresher;
+
+  if (NULL == app) {
+    return NULL;
+  }
+
+  refresher = (newrelic_refresher_t*)nr_zalloc(sizeof(newrelic_refresher_t));
+  refresher->app = app;
+  refresher->callback = callback;
+  refresher->userdata = userdata;
+  nrt_mutex_init(&refresher->mutex, 0);
+  nrt_cond_init(&refresher->wake);
+
+  if (NR_SUCCESS
+      != nrt_create(&refresher->thread, NULL, newrelic_refresher_main,
+                    refresher)) {
+    nrl_error(NRL_INSTRUMENT, "unable to start application refresher thread");
+    nrt_cond_destroy(&refresher->wake);
+    nrt_mutex_destroy(&refresher->mutex);
+    nr_free(refresher);
+    return NULL;
+  }
+
+  nrl_debug(NRL_INSTRUMENT, "application refresher started");
+  return refresher;
+}
+
+void newrelic_refresher_stop(newrelic_refresher_t** refresher_ptr) {
+  newrelic_refresher_t* refresher;
+
+  if ((NULL == refresher_ptr) || (NULL == *refresher_ptr)) {
+    return;
+  }
+
+  refresher = *refresher_ptr;
+
+  nrt_mutex_lock(&refresher->mutex);
+  refresher->stopping = true;
+  nrt_cond_signal(&refresher->wake);
+  nrt_mutex_unlock(&refresher->mutex);
+
+  nrt_join(refresher->thread, NULL);
+
+  nrt_cond_destroy(&refresher->wake);
+  nrt_mutex_destroy(&refresher->mutex);
+  nr_realfree((void**)refresher_ptr);
+
+  nrl_debug(NRL_INSTRUMENT, "application refresher stopped");
+}
@@ -11,54 +11,137 @@
 
 #include <stdio.h>
 
-static nrthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+/* The longest "category/name" segment name built without a heap allocation,
+ * including the terminator. */
+#define NEWRELIC_SEGMENT_NAME_BUFFER_SIZE 256
+
+/*
+ * Whether a segment handle is the record of a custom segment recorded into a
+ * per-thread buffer.
+ */
+static bool newrelic_segment_is_buffered(const newrelic_segment_t* segment) {
+  return NULL != segment->record.buffer;
+}
 
-newrelic_segment_t* newrelic_segment_create(nrtxn_t* txn) {
+/*
+ * Destroyed segment handles are kept in a free list on their transaction and
+ * reused by its next segment, so starting a segment takes no process wide
+ * lock and does not normally touch the heap. The handles themselves are
+ * allocated one by one, as the caller may still hold a handle once the
+ * transaction has ended.
+ */
+newrelic_segment_t* newrelic_segment_create(newrelic_txn_t* transaction) {
   newrelic_segment_t* segment;
   nr_segment_t* txn_seg;
 
-  txn_seg = nr_segment_start(txn, NULL, NULL);
+  txn_seg = nr_segment_start(transaction->txn, NULL, NULL);
   if (NULL == txn_seg) {
     return NULL;
   }
 
-  nrt_mutex_lock(&mutex);
-  segment = nr_zalloc(sizeof(newrelic_segment_t));
-  nrt_mutex_unlock(&mutex);
+  if (transaction->free_segments) {
+    segment = transaction->free_segments;
+    transaction->free_segments = segment->next;
+    nr_memset(segment, 0, sizeof(*segment));
+  } else {
+    segment = nr_zalloc(sizeof(newrelic_segment_t));
+  }
 
-  segment->transaction = txn;
+  segment->transaction = transaction->txn;
   segment->segment = txn_seg;
+  segment->txn_lock = &transaction->lock;
+  segment->owner = transaction;
+
+  segment->next = transaction->live_segments;
+  if (segment->next) {
+    segment->next->prev = segment;
+  }
+  transaction->live_segments = segment;
 
   return segment;
 }
 
+/*
+ * Free the type specific fields of a segment handle.
+ */
+static void newrelic_segment_destroy_fields(newrelic_segment_t* segment) {
+  if (nrunlikely(NULL == segment->segment)) {
+    return;
+  }
+
+  switch (segment->segment->type) {
+    case NR_SEGMENT_DATASTORE:
+      newrelic_destroy_datastore_segment_fields(segment);
+      break;
+    case NR_SEGMENT_EXTERNAL:
+      newrelic_destroy_external_segment_fields(segment);
+      break;
+    case NR_SEGMENT_CUSTOM:
+      /* No special destruction needed */
+      break;
+    default:
+      nrl_error(NRL_INSTRUMENT, "unknown segment type %d",
+                (int)segment->segment->type);
+  }
+}
+
 void newrelic_segment_destroy(newrelic_segment_t** segment_ptr) {
   newrelic_segment_t* segment;
+  newrelic_txn_t* owner;
 
   if (nrunlikely(NULL == segment_ptr || NULL == *segment_ptr)) {
     return;
   }
 
   segment = *segment_ptr;
-  /* Destroy any type specific fields. */
-  if (nrlikely(segment->segment)) {
-    switch (segment->segment->type) {
-      case NR_SEGMENT_DATASTORE:
-        newrelic_destroy_datastore_segment_fields(segment);
-        break;
-      case NR_SEGMENT_EXTERNAL:
-        newrelic_destroy_external_segment_fields(segment);
-        break;
-      case NR_SEGMENT_CUSTOM:
-        /* No special destruction needed */
-        break;
-      default:
-        nrl_error(NRL_INSTRUMENT, "unknown segment type %d",
-                  (int)segment->segment->type);
-    }
+  *segment_ptr = NULL;
+
+  /* Buffered custom segments have no type specific fields, and their handles
+   * are kept in the buffer until the transaction is destroyed. */
+  if (newrelic_segment_is_buffered(segment)) {
+    return;
+  }
+
+  /* The handle outlived its transaction, which has already freed its type
+   * specific fields. */
+  owner = segment->owner;
+  if (NULL == owner) {
+    nr_free(segment);
+    return;
+  }
+
+  nrt_mutex_lock(&owner->lock);
+  newrelic_segment_destroy_fields(segment);
+  if (segment->prev) {
+    segment->prev->next = segment->next;
+  } else {
+    owner->live_segments = segment->next;
+  }
+  if (segment->next) {
+    segment->next->prev = segment->prev;
+  }
+  segment->prev = NULL;
+  segment->next = owner->free_segments;
+  owner->free_segments = segment;
+  nrt_mutex_unlock(&owner->lock);
+}
+
+void newrelic_segment_release_all(newrelic_txn_t* transaction) {
+  newrelic_segment_t* segment;
+
+  while (transaction->free_segments) {
+    segment = transaction->free_segments;
+    transaction->free_segments = segment->next;
+    nr_free(segment);
   }
 
-  nr_realfree((void**)segment_ptr);
+  while (transaction->live_segments) {
+    segment = transaction->live_segments;
+    transaction->live_segments = segment->next;
+
+    newrelic_segment_destroy_fields(segment);
+    nr_memset(segment, 0, sizeof(*segment));
+  }
 }
 
 bool newrelic_validate_segment_param(const char* in, const char* name) {
@@ -74,6 +157,41 @@ bool newrelic_validate_segment_param(const char* in, const char* name) {
   return true;
 }
 
+/*
+ * Build the "category/name" name of a custom segment in the given buffer, or
+ * on the heap if it is too long. The caller must free a result that is not
+ * the buffer.
+ */
+static char* newrelic_segment_name(char* buf,
+                                   size_t buf_len,
+                                   const char* category,
+                                   const char* name) {
+  int len = snprintf(buf, buf_len, "%s/%s", category, name);
+
+  if ((len >= 0) && ((size_t)len < buf_len)) {
+    return buf;
+  }
+
+  return nr_formatf("%s/%s", category, name);
+}
+
+/*
+ * Replace a custom segment name or category that is missing or invalid with
+ * its default.
+ */
+static void newrelic_validate_segment_name(const char** name_ptr,
+                                           const char** category_ptr) {
+  if (!*name_ptr
+      || !newrelic_validate_segment_param(*name_ptr, "segment name")) {
+    *name_ptr = "Unnamed Segment";
+  }
+
+  if (!*category_ptr
+      || !newrelic_validate_segment_param(*category_ptr, "segment category")) {
+    *category_ptr = "Custom";
+  }
+}
+
 newrelic_segment_t* newrelic_start_segment(newrelic_txn_t* transaction,
                                            const char* name,
                                            const char* category) {
@@ -84,37 +202,53 @@ newrelic_segment_t* newrelic_start_segment(newrelic_txn_t* transaction,
     return NULL;
   }
 
-  if (!name || !newrelic_validate_segment_param(name, "segment name")) {
-    name = "Unnamed Segment";
-  }
+  newrelic_validate_segment_name(&name, &category);
+
+  /* If the transaction records custom segments into per-thread buffers, the
+   * segment is started without the transaction lock. */
+  if (0 != transaction->txn->segment_record_size) {
+    char buf[NEWRELIC_SEGMENT_NAME_BUFFER_SIZE];
+    char* segment_name = newrelic_segment_name(buf, sizeof(buf), category, name);
+
+    segment = (newrelic_segment_t*)nr_segment_record_start(transaction->txn,
+                                                           segment_name);
+    if (segment_name != buf) {
+      nr_free(segment_name);
+    }
+    if (segment) {
+      segment->transaction = transaction->txn;
+      segment->txn_lock = &transaction->lock;
+      segment->owner = transaction;
+    }
 
-  if (!category
-      || !newrelic_validate_segment_param(category, "segment category")) {
-    category = "Custom";
+    return segment;
   }
 
   /* Set up the fields so that we can correctly track child segment duration. */
   nrt_mutex_lock(&transaction->lock);
   {
-    char* metric_name;
+    char buf[NEWRELIC_SEGMENT_NAME_BUFFER_SIZE];
+    char* segment_name;
 
     /* Start the segment. */
-    segment = newrelic_segment_create(transaction->txn);
+    segment = newrelic_segment_create(transaction);
     if (NULL == segment) {
       goto unlock_and_end;
     }
 
-    /* Set the segment name. */
-    metric_name = nr_formatf("%s/%s", category, name);
-    nr_segment_set_name(segment->segment, metric_name);
-    nr_free(metric_name);
+    /* Set the segment name. The name is interned in the transaction's string
+     * pool, so it is only built on the heap if it is too long for the stack
+     * buffer. */
+    segment_name = newrelic_segment_name(buf, sizeof(buf), category, name);
+    nr_segment_set_name(segment->segment, segment_name);
+    if (segment_name != buf) {
+      nr_free(segment_name);
+    }
 
   unlock_and_end:;
   }
   nrt_mutex_unlock(&transaction->lock);
 
-  segment->txn_lock = &transaction->lock;
-
   return segment;
 }
 
@@ -139,10 +273,28 @@ bool newrelic_set_segment_parent(newrelic_segment_t* segment,
     return false;
   }
 
+  if (NULL == segment->transaction || NULL == parent->transaction) {
+    nrl_error(NRL_INSTRUMENT,
+              "unable to set the parent on a segment without a transaction");
+    return false;
+  }
+
+  if (newrelic_segment_is_buffered(segment)
+      != newrelic_segment_is_buffered(parent)) {
+    nrl_error(NRL_INSTRUMENT,
+              "unable to set the parent of a segment recorded into a thread "
+              "buffer to a segment that is not, or vice versa");
+    return false;
+  }
+
   nrt_mutex_lock(segment->txn_lock);
   newrelic_add_api_supportability_metric(segment->transaction,
                                          "set_segment_parent");
-  ret = nr_segment_set_parent(segment->segment, parent->segment);
+  if (newrelic_segment_is_buffered(segment)) {
+    ret = nr_segment_record_set_parent(&segment->record, &parent->record);
+  } else {
+    ret = nr_segment_set_parent(segment->segment, parent->segment);
+  }
   nrt_mutex_unlock(segment->txn_lock);
 
   return ret;
@@ -173,8 +325,12 @@ bool newrelic_set_segment_parent_root(newrelic_segment_t* segment) {
   {
     newrelic_add_api_supportability_metric(segment->transaction,
                                            "set_segment_parent_root");
-    ret = nr_segment_set_parent(segment->segment,
-                                segment->transaction->segment_root);
+    if (newrelic_segment_is_buffered(segment)) {
+      ret = nr_segment_record_set_parent(&segment->record, NULL);
+    } else {
+      ret = nr_segment_set_parent(segment->segment,
+                                  segment->transaction->segment_root);
+    }
   }
   nrt_mutex_unlock(segment->txn_lock);
 
@@ -191,6 +347,17 @@ bool newrelic_set_segment_timing(newrelic_segment_t* segment,
     return false;
   }
 
+  if (newrelic_segment_is_buffered(segment)) {
+    nr_segment_record_set_timing(&segment->record, start_time, duration);
+    return true;
+  }
+
+  if (NULL == segment->transaction) {
+    nrl_error(NRL_INSTRUMENT,
+              "unable to set timing on a segment without a transaction");
+    return false;
+  }
+
   nrt_mutex_lock(segment->txn_lock);
   ret = nr_segment_set_timing(segment->segment, start_time, duration);
   nrt_mutex_unlock(segment->txn_lock);
@@ -225,6 +392,14 @@ bool newrelic_end_segment(newrelic_txn_t* transaction,
     goto end;
   }
 
+  /* Buffered custom segments are ended without the transaction lock, and
+   * create their metric when the transaction ends. */
+  if (newrelic_segment_is_buffered(segment)) {
+    nr_segment_record_end(&segment->record, true);
+    status = true;
+    goto end;
+  }
+
   nrt_mutex_lock(&transaction->lock);
   {
     switch (segment->segment->type) {
@@ -252,6 +427,12 @@ bool newrelic_end_segment(newrelic_txn_t* transaction,
                   (int)segment->segment->type);
         status = false;
     }
+
+    /* Once the lock is released, the ended segment may be folded by the
+     * segment budget and reused by another thread, so this is the last use
+     * of it. */
+    newrelic_segment_destroy_fields(segment);
+    segment->segment = NULL;
   }
   nrt_mutex_unlock(&transaction->lock);
 
@@ -262,3 +443,108 @@ end:
 
   return status;
 }
+
+/*
+ * Record a single completed segment under the given parent, using a handle on
+ * the stack. The transaction must be locked.
+ */
+static bool newrelic_record_segment(newrelic_txn_t* transaction,
+                                    nr_segment_t* parent,
+                                    const newrelic_segment_record_t* record) {
+  newrelic_segment_t handle;
+  const char* name = record->name;
+  const char* category = record->category;
+  char buf[NEWRELIC_SEGMENT_NAME_BUFFER_SIZE];
+  char* segment_name;
+
+  if (record->datastore) {
+    if (!newrelic_validate_datastore_segment_params(record->datastore)) {
+      return false;
+    }
+  } else if (record->external) {
+    if (!newrelic_validate_external_segment_params(record->external)) {
+      return false;
+    }
+  } else {
+    newrelic_validate_segment_name(&name, &category);
+  }
+
+  nr_memset(&handle, 0, sizeof(handle));
+  handle.segment = nr_segment_start(transaction->txn, parent, NULL);
+  if (NULL == handle.segment) {
+    return false;
+  }
+  handle.transaction = transaction->txn;
+  nr_segment_set_timing(handle.segment, record->start_time, record->duration);
+
+  if (record->datastore) {
+    newrelic_init_datastore_segment(&handle, record->datastore);
+    return newrelic_end_datastore_segment(&handle);
+  }
+
+  if (record->external) {
+    newrelic_init_external_segment(&handle, record->external);
+    return newrelic_end_external_segment(&handle);
+  }
+
+  segment_name = newrelic_segment_name(buf, sizeof(buf), category, name);
+  nr_segment_set_name(handle.segment, segment_name);
+  nr_segment_end(handle.segment);
+  nr_segment_add_metric(handle.segment, segment_name, true);
+  if (segment_name != buf) {
+    nr_free(segment_name);
+  }
+
+  return true;
+}
+
+size_t newrelic_record_segments(newrelic_txn_t* transaction,
+                                newrelic_segment_t* parent,
+                                const newrelic_segment_record_t* records,
+                                size_t count) {
+  nr_segment_t* parent_segment;
+  size_t recorded = 0;
+  size_t i;
+
+  if (NULL == transaction) {
+    nrl_error(NRL_INSTRUMENT,
+              "unable to record segments on a NULL transaction");
+    return 0;
+  }
+
+  if ((NULL == records) && (0 != count)) {
+    nrl_error(NRL_INSTRUMENT, "unable to record NULL segment records");
+    return 0;
+  }
+
+  if (parent) {
+    if (newrelic_segment_is_buffered(parent)) {
+      nrl_error(NRL_INSTRUMENT,
+                "unable to record segments under a segment recorded into a "
+                "thread buffer");
+      return 0;
+    }
+    if (transaction->txn != parent->transaction) {
+      nrl_error(NRL_INSTRUMENT,
+                "unable to record segments under a segment of a different "
+                "transaction");
+      return 0;
+    }
+  }
+
+  nrt_mutex_lock(&transaction->lock);
+  {
+    newrelic_add_api_supportability_metric(transaction->txn,
+                                           "record_segments");
+
+    parent_segment = parent ? parent->segment : transaction->txn->segment_root;
+    for (i = 0; i < count; i++) {
+      if (newrelic_record_segment(transaction, parent_segment, &records[i])) {
+        recorded += 1;
+      }
+    }
+  }
+  nrt_mutex_unlock(&transaction->lock);
+
+  return recorded;
+}
@@ -0,0 +1,528 @@
+#include "libnewrelic.h"
+#include "sender.h"
+
+#include "nr_agent.h"
+#include "nr_commands.h"
+#include "nr_distributed_trace.h"
+#include "util_flatbuffers.h"
+#include "util_logging.h"
+#include "util_memory.h"
+#include "util_metrics.h"
+#include "util_strings.h"
+#include "util_threads.h"
+#include "util_time.h"
+
+/*
+ * Counts of transactions that were lost rather than sent, by reason.
+ */
+typedef struct _newrelic_sender_drops_t {
+  uint64_t queue_full;
+  uint64_t send_failed;
+} newrelic_sender_drops_t;
+
+#define NEWRELIC_SENDER_DROPPED_QUEUE_FULL \
+  "Supportability/C/Sender/Dropped/QueueFull"
+#define NEWRELIC_SENDER_DROPPED_SEND_FAILED \
+  "Supportability/C/Sender/Dropped/SendFailed"
+
+/*
+ * The sender state. The queue is a ring buffer of finished transactions,
+ * protected by the mutex; the condition variable is signalled whenever a
+ * transaction is queued or the sender is asked to stop. When the drop policy
+ * is NEWRELIC_DROP_LOWEST_PRIORITY, priorities holds the sampling priority of
+ * each queued transaction, in the same slots, so that finding the lowest does
+ * not touch every transaction.
+ *
+ * Drops are counted in dropped, under the mutex, until the sender thread
+ * attaches them to a transaction as Supportability metrics. From then until
+ * that transaction has been written they are counted in reporting, which only
+ * the sender thread touches; if the write fails they go back to dropped.
+ *
+ * The batch fields are only touched by the sender thread while it runs: they
+ * hold encoded transactions waiting to be written to the daemon together.
+ * So is agent_run_id, the run of the last transaction taken from the queue,
+ * under which any drops still unreported when the sender stops are sent.
+ *
+ * The sender is shared by every application that started it; users counts
+ * them, and the sender only stops when the last of them releases it.
+ */
+typedef struct _newrelic_sender_t {
+  nrthread_mutex_t mutex;
+  nrthread_cond_t not_empty;
+  nrthread_t thread;
+  bool running;
+  bool stopping;
+  size_t users;
+
+  nrtxn_t** queue;
+  nr_sampling_priority_t* priorities;
+  size_t capacity;
+  size_t head;
+  size_t count;
+  newrelic_sender_drop_policy_t drop_policy;
+
+  newrelic_sender_drops_t dropped;
+  newrelic_sender_drops_t reporting;
+
+  nr_flatbuffer_t** batch;
+  size_t batch_size;
+  size_t batch_count;
+  nrtime_t batch_timeout;
+  nrtime_t batch_deadline;
+
+  char* agent_run_id;
+} newrelic_sender_t;
+
+static newrelic_sender_t newrelic_sender = {
+    .mutex = NRTHREAD_MUTEX_INITIALIZER,
+    .not_empty = NRTHREAD_COND_INITIALIZER,
+};
+
+/*
+ * Take the drops not yet reported, leaving none behind.
+ */
+static newrelic_sender_drops_t newrelic_sender_take_drops(void) {
+  newrelic_sender_drops_t drops;
+
+  nrt_mutex_lock(&newrelic_sender.mutex);
+  drops = newrelic_sender.dropped;
+  newrelic_sender.dropped.queue_full = 0;
+  newrelic_sender.dropped.send_failed = 0;
+  nrt_mutex_unlock(&newrelic_sender.mutex);
+
+  return drops;
+}
+
+static void newrelic_sender_add_drops(nrmtable_t* table,
+                                      newrelic_sender_drops_t drops) {
+  if (drops.queue_full) {
+    nrm_add_internal(1, table, NEWRELIC_SENDER_DROPPED_QUEUE_FULL,
+                     (nrtime_t)drops.queue_full, 0, 0, 0, 0, 0);
+  }
+  if (drops.send_failed) {
+    nrm_add_internal(1, table, NEWRELIC_SENDER_DROPPED_SEND_FAILED,
+                     (nrtime_t)drops.send_failed, 0, 0, 0, 0, 0);
+  }
+}
+
+/*
+ * Attach any unreported drops to a transaction about to be sent, returning
+ * the drops attached.
+ */
+static newrelic_sender_drops_t newrelic_sender_report_drops(nrtxn_t* txn) {
+  newrelic_sender_drops_t drops = newrelic_sender_take_drops();
+
+  newrelic_sender_add_drops(txn->unscoped_metrics, drops);
+
+  newrelic_sender.reporting.queue_full += drops.queue_full;
+  newrelic_sender.reporting.send_failed += drops.send_failed;
+
+  return drops;
+}
+
+/*
+ * Return drops that were attached to a transaction which was then not sent,
+ * so that they are reported with a later one.
+ */
+static void newrelic_sender_unreport_drops(newrelic_sender_drops_t drops) {
+  newrelic_sender.reporting.queue_full -= drops.queue_full;
+  newrelic_sender.reporting.send_failed -= drops.send_failed;
+
+  nrt_mutex_lock(&newrelic_sender.mutex);
+  newrelic_sender.dropped.queue_full += drops.queue_full;
+  newrelic_sender.dropped.send_failed += drops.send_failed;
+  nrt_mutex_unlock(&newrelic_sender.mutex);
+}
+
+/*
+ * Record the outcome of writing the given number of transactions, which
+ * carried every drop currently being reported.
+ */
+static void newrelic_sender_sent(nr_status_t st, size_t count) {
+  if (NR_SUCCESS != st) {
+    nrt_mutex_lock(&newrelic_sender.mutex);
+    newrelic_sender.dropped.queue_full += newrelic_sender.reporting.queue_full;
+    newrelic_sender.dropped.send_failed
+        += newrelic_sender.reporting.send_failed + count;
+    nrt_mutex_unlock(&newrelic_sender.mutex);
+  }
+
+  newrelic_sender.reporting.queue_full = 0;
+  newrelic_sender.reporting.send_failed = 0;
+}
+
+static void newrelic_sender_send(nrtxn_t* txn) {
+  nr_status_t st;
+
+  newrelic_sender_report_drops(txn);
+
+  st = nr_cmd_txndata_tx(nr_get_daemon_fd(), txn);
+  if (NR_FAILURE == st) {
+    nrl_error(NRL_INSTRUMENT, "failed to send transaction");
+  }
+  newrelic_sender_sent(st, 1);
+
+  nr_txn_destroy(&txn);
+}
+
+static void newrelic_sender_flush(void) {
+  nr_status_t st;
+  size_t i;
+
+  if (0 == newrelic_sender.batch_count) {
+    return;
+  }
+
+  st = nr_cmd_txndata_tx_batch(nr_get_daemon_fd(), newrelic_sender.batch,
+                               newrelic_sender.batch_count);
+  if (NR_FAILURE == st) {
+    nrl_error(NRL_INSTRUMENT, "failed to send %zu transactions",
+              newrelic_sender.batch_count);
+  }
+  newrelic_sender_sent(st, newrelic_sender.batch_count);
+
+  for (i = 0; i < newrelic_sender.batch_count; i++) {
+    nr_cmd_txndata_release(&newrelic_sender.batch[i]);
+  }
+  newrelic_sender.batch_count = 0;
+}
+
+/*
+ * Encode a transaction into the current batch, flushing the batch if it is
+ * full or its oldest transaction has waited for the batch timeout.
+ */
+static void newrelic_sender_batch(nrtxn_t* txn) {
+  newrelic_sender_drops_t drops = newrelic_sender_report_drops(txn);
+  nr_flatbuffer_t* msg = nr_cmd_txndata_encode(txn);
+  nrtime_t now = nr_get_time();
+
+  nr_txn_destroy(&txn);
+
+  if (NULL == msg) {
+    nrl_error(NRL_INSTRUMENT, "failed to encode transaction");
+    newrelic_sender_unreport_drops(drops);
+    return;
+  }
+
+  if (0 == newrelic_sender.batch_count) {
+    newrelic_sender.batch_deadline = now + newrelic_sender.batch_timeout;
+  }
+  newrelic_sender.batch[newrelic_sender.batch_count] = msg;
+  newrelic_sender.batch_count += 1;
+
+  if ((newrelic_sender.batch_count >= newrelic_sender.batch_size)
+      || (now >= newrelic_sender.batch_deadline)) {
+    newrelic_sender_flush();
+  }
+}
+
+/*
+ * Send the drops left unreported once the last transaction has been written,
+ * in a message of their own, so that they are not lost when the sender stops.
+ * If there is no agent run to send them under, or the write fails, the
+ * totals are logged instead.
+ */
+static void newrelic_sender_report_last_drops(void) {
+  newrelic_sender_drops_t drops = newrelic_sender_take_drops();
+  nr_status_t st = NR_FAILURE;
+
+  if ((0 == drops.queue_full) && (0 == drops.send_failed)) {
+    return;
+  }
+
+  if (newrelic_sender.agent_run_id) {
+    nrmtable_t* table = nrm_table_create(2);
+    nr_flatbuffer_t* msg;
+
+    newrelic_sender_add_drops(table, drops);
+    msg = nr_cmd_txndata_encode_metrics(newrelic_sender.agent_run_id, NULL,
+                                        table, NULL);
+    if (msg) {
+      st = nr_cmd_txndata_tx_batch(nr_get_daemon_fd(), &msg, 1);
+      nr_cmd_txndata_release(&msg);
+    }
+    nrm_table_destroy(&table);
+  }
+
+  if (NR_SUCCESS != st) {
+    nrl_warning(NRL_INSTRUMENT,
+                "transaction sender stopped with unreported drops: "
+                "queue_full=%llu send_failed=%llu",
+                (unsigned long long)drops.queue_full,
+                (unsigned long long)drops.send_failed);
+  }
+}
+
+static void* newrelic_sender_main(void* arg NRUNUSED) {
+  nrt_mutex_lock(&newrelic_sender.mutex);
+  for (;;) {
+    nrtxn_t* txn = NULL;
+
+    while ((0 == newrelic_sender.count) && !newrelic_sender.stopping) {
+      if (0 == newrelic_sender.batch_count) {
+        nrt_cond_wait(&newrelic_sender.not_empty, &newrelic_sender.mutex);
+      } else if (NR_FAILURE
+                 == nrt_cond_timedwait(&newrelic_sender.not_empty,
+                                       &newrelic_sender.mutex,
+                                       newrelic_sender.batch_deadline)) {
+        /* The pending batch has reached its age limit. */
+        break;
+      }
+    }
+
+    if (newrelic_sender.count > 0) {
+      txn = newrelic_sender.queue[newrelic_sender.head];
+      newrelic_sender.queue[newrelic_sender.head] = NULL;
+      newrelic_sender.head
+          = (newrelic_sender.head + 1) % newrelic_sender.capacity;
+      newrelic_sender.count -= 1;
+    } else if (newrelic_sender.stopping
+               && (0 == newrelic_sender.batch_count)) {
+      break;
+    }
+
+    /*
+     * Encoding and writing happen outside the lock, so that callers of
+     * newrelic_sender_enqueue() never wait on the daemon socket.
+     */
+    nrt_mutex_unlock(&newrelic_sender.mutex);
+    if (txn && txn->agent_run_id
+        && !nr_streq(txn->agent_run_id, newrelic_sender.agent_run_id)) {
+      nr_free(newrelic_sender.agent_run_id);
+      newrelic_sender.agent_run_id = nr_strdup(txn->agent_run_id);
+    }
+    if (NULL == txn) {
+      newrelic_sender_flush();
+    } else if (newrelic_sender.batch_size > 1) {
+      newrelic_sender_batch(txn);
+    } else {
+      newrelic_sender_send(txn);
+    }
+    nrt_mutex_lock(&newrelic_sender.mutex);
+  }
+  nrt_mutex_unlock(&newrelic_sender.mutex);
+
+  newrelic_sender_report_last_drops();
+
+  return NULL;
+}
+
+bool newrelic_sender_start(const newrelic_sender_config_t* config) {
+  bool ret = true;
+
+  if ((NULL == config) || (0 == config->queue_size)) {
+    nrl_error(NRL_INSTRUMENT, "cannot start sender with an empty queue");
+    return false;
+  }
+
+  nrt_mutex_lock(&newrelic_sender.mutex);
+  if (newrelic_sender.stopping) {
+    nrl_error(NRL_INSTRUMENT, "cannot start sender while it is stopping");
+    ret = false;
+  } else if (newrelic_sender.running) {
+    newrelic_sender.users += 1;
+  } else {
+    newrelic_sender.capacity = (size_t)config->queue_size;
+    newrelic_sender.queue
+        = (nrtxn_t**)nr_calloc(newrelic_sender.capacity, sizeof(nrtxn_t*));
+    newrelic_sender.head = 0;
+    newrelic_sender.count = 0;
+    newrelic_sender.stopping = false;
+    newrelic_sender.drop_policy = config->drop_policy;
+    if (NEWRELIC_DROP_LOWEST_PRIORITY == config->drop_policy) {
+      newrelic_sender.priorities = (nr_sampling_priority_t*)nr_calloc(
+          newrelic_sender.capacity, sizeof(nr_sampling_priority_t));
+    }
+
+    newrelic_sender.batch_size
+        = (config->batch_size > 1) ? (size_t)config->batch_size : 1;
+    newrelic_sender.batch
+        = (nr_flatbuffer_t**)nr_calloc(newrelic_sender.batch_size,
+                                       sizeof(nr_flatbuffer_t*));
+    newrelic_sender.batch_count = 0;
+    newrelic_sender.batch_timeout
+        = (nrtime_t)config->batch_timeout_ms * NR_TIME_DIVISOR_MS;
+
+    if (NR_SUCCESS
+        == nrt_create(&newrelic_sender.thread, NULL, newrelic_sender_main,
+                      NULL)) {
+      newrelic_sender.running = true;
+      newrelic_sender.users = 1;
+      nrl_debug(NRL_INSTRUMENT,
+                "transaction sender started: queue_size=%zu batch_size=%zu "
+                "batch_timeout_ms=%u drop_policy=%d",
+                newrelic_sender.capacity, newrelic_sender.batch_size,
+                config->batch_timeout_ms, (int)config->drop_policy);
+    } else {
+      nrl_error(NRL_INSTRUMENT, "unable to start transaction sender thread");
+      nr_free(newrelic_sender.queue);
+      nr_free(newrelic_sender.priorities);
+      nr_free(newrelic_sender.batch);
+      newrelic_sender.capacity = 0;
+      ret = false;
+    }
+  }
+  nrt_mutex_unlock(&newrelic_sender.mutex);
+
+  return ret;
+}
+
+static nr_sampling_priority_t newrelic_sender_priority(const nrtxn_t* txn) {
+  return nr_distributed_trace_get_priority(txn->distributed_trace);
+}
+
+/*
+ * Add a transaction to the tail of the queue, which must not be full. The
+ * caller must hold the mutex.
+ */
+static void newrelic_sender_push(nrtxn_t* txn) {
+  size_t tail = (newrelic_sender.head + newrelic_sender.count)
+                % newrelic_sender.capacity;
+
+  newrelic_sender.queue[tail] = txn;
+  if (newrelic_sender.priorities) {
+    newrelic_sender.priorities[tail] = newrelic_sender_priority(txn);
+  }
+  newrelic_sender.count += 1;
+  nrt_cond_signal(&newrelic_sender.not_empty);
+}
+
+/*
+ * Make room in a full queue for a transaction by removing the lowest
+ * priority transaction, which may be the new one. On a tie the new
+ * transaction loses. Returns the transaction to drop. The caller must hold
+ * the mutex.
+ */
+static nrtxn_t* newrelic_sender_evict_lowest(nrtxn_t* txn) {
+  nr_sampling_priority_t lowest = newrelic_sender_priority(txn);
+  size_t capacity = newrelic_sender.capacity;
+  size_t victim = newrelic_sender.count;
+  nrtxn_t* dropped;
+  size_t i;
+
+  for (i = 0; i < newrelic_sender.count; i++) {
+    size_t slot = (newrelic_sender.head + i) % capacity;
+
+    if (newrelic_sender.priorities[slot] < lowest) {
+      lowest = newrelic_sender.priorities[slot];
+      victim = i;
+    }
+  }
+
+  if (victim == newrelic_sender.count) {
+    return txn;
+  }
+
+  /* Close the gap, keeping the remaining transactions in order. */
+  dropped = newrelic_sender.queue[(newrelic_sender.head + victim) % capacity];
+  for (i = victim; i + 1 < newrelic_sender.count; i++) {
+    size_t to = (newrelic_sender.head + i) % capacity;
+    size_t from = (newrelic_sender.head + i + 1) % capacity;
+
+    newrelic_sender.queue[to] = newrelic_sender.queue[from];
+    newrelic_sender.priorities[to] = newrelic_sender.priorities[from];
+  }
+  newrelic_sender.count -= 1;
+  newrelic_sender_push(txn);
+
+  return dropped;
+}
+
+bool newrelic_sender_enqueue(nrtxn_t* txn) {
+  nrtxn_t* dropped = NULL;
+  bool ret = false;
+
+  if (NULL == txn) {
+    return false;
+  }
+
+  nrt_mutex_lock(&newrelic_sender.mutex);
+  if (newrelic_sender.running && !newrelic_sender.stopping) {
+    if (newrelic_sender.count < newrelic_sender.capacity) {
+      newrelic_sender_push(txn);
+      ret = true;
+    } else {
+      switch (newrelic_sender.drop_policy) {
+        case NEWRELIC_DROP_NEWEST:
+          dropped = txn;
+          break;
+        case NEWRELIC_DROP_OLDEST:
+          dropped = newrelic_sender.queue[newrelic_sender.head];
+          newrelic_sender.queue[newrelic_sender.head] = NULL;
+          newrelic_sender.head
+              = (newrelic_sender.head + 1) % newrelic_sender.capacity;
+          newrelic_sender.count -= 1;
+          newrelic_sender_push(txn);
+          break;
+        case NEWRELIC_DROP_LOWEST_PRIORITY:
+          dropped = newrelic_sender_evict_lowest(txn);
+          break;
+        case NEWRELIC_DROP_NONE:
+        default:
+          break;
+      }
+
+      if (dropped) {
+        newrelic_sender.dropped.queue_full += 1;
+        ret = true;
+      }
+    }
+  }
+  nrt_mutex_unlock(&newrelic_sender.mutex);
+
+  /* Dropped transactions are destroyed outside the lock. */
+  nr_txn_destroy(&dropped);
+
+  return ret;
+}
+
+/*
+ * Stop the sender thread. If release is true, only one user's hold on the
+ * sender is given up, and the sender keeps running for any others.
+ */
+static void newrelic_sender_halt(bool release) {
+  nrthread_t thread;
+
+  nrt_mutex_lock(&newrelic_sender.mutex);
+  if (!newrelic_sender.running || newrelic_sender.stopping) {
+    nrt_mutex_unlock(&newrelic_sender.mutex);
+    return;
+  }
+  if (release && (newrelic_sender.users > 1)) {
+    newrelic_sender.users -= 1;
+    nrt_mutex_unlock(&newrelic_sender.mutex);
+    return;
+  }
+  newrelic_sender.stopping = true;
+  thread = newrelic_sender.thread;
+  nrt_cond_broadcast(&newrelic_sender.not_empty);
+  nrt_mutex_unlock(&newrelic_sender.mutex);
+
+  /* The sender thread drains the queue and the batch before it exits. */
+  nrt_join(thread, NULL);
+
+  nrt_mutex_lock(&newrelic_sender.mutex);
+  nr_free(newrelic_sender.queue);
+  nr_free(newrelic_sender.priorities);
+  nr_free(newrelic_sender.batch);
+  nr_free(newrelic_sender.agent_run_id);
+  newrelic_sender.capacity = 0;
+  newrelic_sender.head = 0;
+  newrelic_sender.count = 0;
+  newrelic_sender.batch_size = 0;
+  newrelic_sender.batch_count = 0;
+  newrelic_sender.running = false;
+  newrelic_sender.stopping = false;
+  newrelic_sender.users = 0;
+  nrt_mutex_unlock(&newrelic_sender.mutex);
+
+  nrl_debug(NRL_INSTRUMENT, "transaction sender stopped");
+}
+
+void newrelic_sender_release(void) {
+  newrelic_sender_halt(true);
+}
+
+void newrelic_sender_stop(void) {
+  newrelic_sender_halt(false);
+}
@@ -4,12 +4,14 @@
 #include "config.h"
 #include "global.h"
 #include "segment.h"
+#include "sender.h"
 #include "transaction.h"
 
 #include "nr_agent.h"
 #include "nr_app.h"
 #include "nr_attributes.h"
 #include "nr_commands.h"
+#include "nr_segment_buffer.h"
 #include "nr_txn.h"
 #include "util_logging.h"
 #include "util_memory.h"
@@ -43,6 +45,49 @@ bool newrelic_set_transaction_timing(newrelic_txn_t* transaction,
   return ret;
 }
 
+bool newrelic_send_transaction(nrtxn_t** txn_ptr, bool async_send) {
+  nrtxn_t* txn;
+  bool ret = true;
+
+  if ((NULL == txn_ptr) || (NULL == *txn_ptr)) {
+    return false;
+  }
+
+  txn = *txn_ptr;
+  *txn_ptr = NULL;
+
+  nrl_verbose(NRL_INSTRUMENT,
+              "sending txnname='%.64s'"
+              " agent_run_id=" NR_AGENT_RUN_ID_FMT
+              " segment_count=%zu"
+              " duration=" NR_TIME_FMT " threshold=" NR_TIME_FMT,
+              txn->name ? txn->name : "unknown", txn->agent_run_id,
+              txn->segment_count, nr_txn_duration(txn),
+              txn->options.tt_threshold);
+
+  /*
+   * If the transaction is handed to the background sender, the sender now
+   * owns it, even if its drop policy then drops it. Otherwise, including
+   * when the sender queue is full and nothing is to be dropped, send it
+   * from this thread.
+   */
+  if ((0 == txn->status.ignore) && async_send
+      && newrelic_sender_enqueue(txn)) {
+    return true;
+  }
+
+  if (0 == txn->status.ignore) {
+    if (NR_FAILURE == nr_cmd_txndata_tx(nr_get_daemon_fd(), txn)) {
+      nrl_error(NRL_INSTRUMENT, "failed to send transaction");
+      ret = false;
+    }
+  }
+
+  nr_txn_destroy(&txn);
+
+  return ret;
+}
+
 bool newrelic_end_transaction(newrelic_txn_t** transaction_ptr) {
   newrelic_txn_t* transaction;
   bool ret = true;
@@ -59,30 +104,32 @@ bool newrelic_end_transaction(newrelic_txn_t** transaction_ptr) {
   {
     nrtxn_t* txn = transaction->txn;
 
+    newrelic_segment_release_all(transaction);
+
     version_metric
         = nr_formatf("Supportability/C/NewrelicVersion/%s", newrelic_version());
     nr_txn_force_single_count(txn, version_metric);
     nr_free(version_metric);
 
-    nr_txn_end(txn);
-
-    nrl_verbose(NRL_INSTRUMENT,
-                "sending txnname='%.64s'"
-                " agent_run_id=" NR_AGENT_RUN_ID_FMT
-                " segment_count=%zu"
-                " duration=" NR_TIME_FMT " threshold=" NR_TIME_FMT,
-                txn->name ? txn->name : "unknown", txn->agent_run_id,
-                txn->segment_count, nr_txn_duration(txn),
-                txn->options.tt_threshold);
-
-    if (0 == txn->status.ignore) {
-      if (NR_FAILURE == nr_cmd_txndata_tx(nr_get_daemon_fd(), txn)) {
-        nrl_error(NRL_INSTRUMENT, "failed to send transaction");
-        ret = false;
+    if (NULL == transaction->pending) {
+      nr_txn_end(txn);
+      nr_metric_aggregate_add_txn(transaction->metric_aggregate, txn);
+    } else {
+      /*
+       * The transaction started before the application connected. It is
+       * held until the application has, unless that has happened since.
+       */
+      nr_txn_end_unconnected(txn);
+      if (newrelic_pending_add(transaction->pending, transaction->app, txn)) {
+        txn = NULL;
+      } else if (!newrelic_pending_connect(transaction->app, txn)) {
+        nr_txn_destroy(&txn);
       }
     }
 
-    nr_txn_destroy(&txn);
+    if (txn) {
+      ret = newrelic_send_transaction(&txn, transaction->async_send);
+    }
   }
   nrt_mutex_unlock(&transaction->lock);
 
@@ -98,6 +145,7 @@ newrelic_txn_t* newrelic_start_transaction(newrelic_app_t* app,
   newrelic_txn_t* transaction = NULL;
   nrtxnopt_t* options = NULL;
   nr_attribute_config_t* attribute_config = NULL;
+  bool thread_buffers = false;
 
   if (NULL == app) {
     nrl_error(NRL_INSTRUMENT,
@@ -106,9 +154,14 @@ newrelic_txn_t* newrelic_start_transaction(newrelic_app_t* app,
   }
 
   /*
-   * Query the daemon about the state of the application, if appropriate.
+   * Applications are normally kept up to date by their refresher thread. If
+   * it could not be started, query the daemon here instead, if appropriate.
    */
-  nr_app_consider_appinfo(app->app, time(0));
+  if (NULL == app->refresher) {
+    nr_app_consider_appinfo(app->app, time(0));
+    newrelic_pending_replay(app->pending, app->app);
+    newrelic_app_send_metrics(app, false);
+  }
 
   transaction = nr_malloc(sizeof(newrelic_txn_t));
   if (NR_FAILURE == nrt_mutex_init(&transaction->lock, 0)) {
@@ -120,7 +173,27 @@ newrelic_txn_t* newrelic_start_transaction(newrelic_app_t* app,
   nrt_mutex_lock(&app->lock);
   {
     options = newrelic_get_transaction_options(app->config);
+
+    /* The app lock keeps the refresher from changing the app meanwhile. */
+    nrt_mutex_lock(&app->app->app_lock);
     transaction->txn = nr_txn_begin(app->app, options, attribute_config);
+    transaction->pending = NULL;
+    transaction->app = NULL;
+    transaction->owner = app;
+    transaction->live_segments = NULL;
+    transaction->free_segments = NULL;
+    transaction->metric_aggregate = app->metric_aggregate;
+    if ((NULL == transaction->txn) && app->pending) {
+      transaction->txn
+          = nr_txn_begin_unconnected(app->app, options, attribute_config);
+      transaction->pending = app->pending;
+      transaction->app = app->app;
+      transaction->metric_aggregate = NULL;
+    }
+    nrt_mutex_unlock(&app->app->app_lock);
+    transaction->async_send = app->config ? app->config->sender.async : false;
+    thread_buffers
+        = app->config ? app->config->segments.thread_buffers : false;
   }
   nrt_mutex_unlock(&app->lock);
   if (NULL == transaction->txn) {
@@ -129,6 +202,12 @@ newrelic_txn_t* newrelic_start_transaction(newrelic_app_t* app,
     return NULL;
   }
 
+  /* Custom segment handles are kept in the records of the per-thread
+   * buffers. */
+  if (thread_buffers) {
+    nr_txn_enable_segment_records(transaction->txn, sizeof(newrelic_segment_t));
+  }
+
   if (NULL == name) {
     name = "NULL";
   }
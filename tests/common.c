@@ -2,6 +2,7 @@
 #include "libnewrelic.h"
 #include "config.h"
 #include "transaction.h"
+#include "segment.h"
 
 #include "app.h"
 #include "nr_distributed_trace_private.h"
@@ -81,6 +82,7 @@ int txn_group_teardown(void** state) {
 
   nrt_mutex_destroy(&txn->lock);
 
+  newrelic_segment_release_all(txn);
   nr_txn_destroy(&txn->txn);
   nr_free(txn);
 
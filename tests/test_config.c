@@ -57,6 +57,20 @@ static void test_config_justright_license_key(void** state NRUNUSED) {
 
   assert_false(config->distributed_tracing.enabled);
   assert_true(config->span_events.enabled);
+  assert_false(config->sender.async);
+  assert_int_equal(1000, config->sender.queue_size);
+  assert_int_equal(NEWRELIC_DROP_NONE, config->sender.drop_policy);
+  assert_int_equal(1, config->sender.batch_size);
+  assert_int_equal(100, config->sender.batch_timeout_ms);
+  assert_int_equal(1, config->sender.daemon_connections);
+  assert_int_equal(0, config->sender.shared_memory_size);
+  assert_string_equal("", config->sender.spool_filename);
+  assert_int_equal(0, config->sender.spool_size);
+  assert_false(config->startup.async);
+  assert_int_equal(1000, config->startup.pending_transactions);
+  assert_string_equal("", config->startup.cache_filename);
+  assert_false(config->segments.thread_buffers);
+  assert_int_equal(0, config->segments.max_segments);
 
   newrelic_destroy_app_config(&config);
 }
@@ -26,6 +26,18 @@ nrapp_t* __wrap_nr_agent_find_or_add_app(nrapplist_t* applist NRUNUSED,
   return (nrapp_t*)mock();
 }
 
+nrapp_t* __wrap_nr_agent_find_or_add_app_nowait(
+    nrapplist_t* applist,
+    const nr_app_info_t* info,
+    nrobj_t* (*settings_callback_fn)(void));
+
+nrapp_t* __wrap_nr_agent_find_or_add_app_nowait(
+    nrapplist_t* applist NRUNUSED,
+    const nr_app_info_t* info NRUNUSED,
+    nrobj_t* (*settings_callback_fn)(void) NRUNUSED) {
+  return (nrapp_t*)mock();
+}
+
 static void test_connect_app_is_null(void** state NRUNUSED) {
   nr_status_t result;
 
@@ -90,12 +102,40 @@ static void test_connect_app_successful_connect(void** state NRUNUSED) {
   nr_free(nrapp);
 }
 
+static void test_connect_app_async(void** state NRUNUSED) {
+  nr_status_t result;
+
+  newrelic_app_t* app;
+  nrapp_t* nrapp;
+  nr_app_info_t* app_info;
+
+  nrapp = (nrapp_t*)nr_zalloc(sizeof(nrapp_t));
+  nrapp->state = NR_APP_UNKNOWN;
+  app = (newrelic_app_t*)nr_zalloc(sizeof(newrelic_app_t));
+  app_info = (nr_app_info_t*)nr_zalloc(sizeof(nr_app_info_t));
+  app->app_info = app_info;
+  app->config = newrelic_create_app_config(
+      "app", "0123456789012345678901234567890123456789");
+  app->config->startup.async = true;
+
+  /* The application is added without waiting for it to connect. */
+  will_return(__wrap_nr_agent_find_or_add_app_nowait, nrapp);
+
+  result = newrelic_connect_app(app, 0);
+  assert_true(NR_SUCCESS == result);
+  assert_ptr_equal(nrapp, app->app);
+
+  newrelic_destroy_app(&app);
+  nr_free(nrapp);
+}
+
 int main(void) {
   const struct CMUnitTest tests[] = {
       cmocka_unit_test(test_connect_app_nrapp_is_null),
       cmocka_unit_test(test_connect_app_null_app_info),
       cmocka_unit_test(test_connect_app_successful_connect),
       cmocka_unit_test(test_connect_app_is_null),
+      cmocka_unit_test(test_connect_app_async),
   };
 
   return cmocka_run_group_tests(tests, NULL, NULL);
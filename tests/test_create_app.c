@@ -9,6 +9,7 @@
 #include "libnewrelic.h"
 #include "app.h"
 #include "global.h"
+#include "sender.h"
 #include "test.h"
 #include "util_logging.h"
 #include "util_memory.h"
@@ -19,6 +20,8 @@ bool __wrap_newrelic_ensure_init(const char* daemon_socket, int time_limit_ms);
 nr_status_t __wrap_newrelic_connect_app(newrelic_app_t* app,
                                         unsigned short timeout_ms);
 
+nr_status_t __wrap_nr_cmd_txndata_tx(int daemon_fd, const nrtxn_t* txn);
+
 bool __wrap_newrelic_ensure_init(const char* daemon_socket NRUNUSED,
                                  int time_limit_ms NRUNUSED) {
   return (bool)mock();
@@ -29,6 +32,11 @@ nr_status_t __wrap_newrelic_connect_app(newrelic_app_t* app NRUNUSED,
   return (nr_status_t)mock();
 }
 
+nr_status_t __wrap_nr_cmd_txndata_tx(int daemon_fd NRUNUSED,
+                                     const nrtxn_t* txn NRUNUSED) {
+  return NR_SUCCESS;
+}
+
 static int setup(void** state) {
   newrelic_app_config_t* config;
   config = (newrelic_app_config_t*)nr_zalloc(sizeof(newrelic_app_config_t));
@@ -161,6 +169,38 @@ static void test_create_app_newrelic_app_correctly_populated(
   newrelic_destroy_app(&app);
 }
 
+static void test_create_app_shared_sender(void** state) {
+  newrelic_app_config_t* config = (newrelic_app_config_t*)*state;
+  newrelic_app_t* first;
+  newrelic_app_t* second;
+  nrtxn_t* txn;
+
+  nr_strxcpy(config->app_name, "valid app name", nr_strlen("valid app name"));
+  nr_strxcpy(config->license_key, "0123456789012345678901234567890123456789",
+             40);
+  config->sender.async = true;
+  config->sender.queue_size = 4;
+
+  will_return_count(__wrap_newrelic_ensure_init, true, 2);
+  will_return_count(__wrap_newrelic_connect_app, NR_SUCCESS, 2);
+  first = newrelic_create_app(config, 1000);
+  second = newrelic_create_app(config, 1000);
+  assert_non_null(first);
+  assert_non_null(second);
+  assert_true(first->sender_started);
+  assert_true(second->sender_started);
+
+  /* Destroying one application leaves the sender running for the other. */
+  newrelic_destroy_app(&first);
+  txn = (nrtxn_t*)nr_zalloc(sizeof(nrtxn_t));
+  assert_true(newrelic_sender_enqueue(txn));
+
+  newrelic_destroy_app(&second);
+  txn = (nrtxn_t*)nr_zalloc(sizeof(nrtxn_t));
+  assert_false(newrelic_sender_enqueue(txn));
+  nr_free(txn);
+}
+
 int main(void) {
   const struct CMUnitTest tests[] = {
       cmocka_unit_test(test_create_app_null_config),
@@ -169,6 +209,7 @@ int main(void) {
       cmocka_unit_test(test_create_app_newrelic_connect_app_returns_failure),
       cmocka_unit_test(test_create_app_newrelic_init_fails),
       cmocka_unit_test(test_create_app_newrelic_app_correctly_populated),
+      cmocka_unit_test(test_create_app_shared_sender),
   };
 
   return cmocka_run_group_tests(tests, setup, teardown);
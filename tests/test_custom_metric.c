@@ -1,3 +1,4 @@
+#include <math.h>
 #include <stdarg.h>
 #include <stddef.h>
 
@@ -5,7 +6,11 @@
 #include <cmocka.h>
 
 #include "libnewrelic.h"
+#include "app.h"
+#include "custom_metric.h"
+#include "nr_metric_accumulator_private.h"
 #include "test.h"
+#include "transaction.h"
 
 static void test_custom_metric_inputs(void** state NRUNUSED) {
   newrelic_txn_t* txn = (newrelic_txn_t*)*state;
@@ -17,9 +22,127 @@ static void test_custom_metric_inputs(void** state NRUNUSED) {
   assert_false(newrelic_record_custom_metric(txn, NULL, 40.12));
 }
 
+static void test_record_distribution_metric(void** state) {
+  newrelic_txn_t* txn = (newrelic_txn_t*)*state;
+
+  assert_false(newrelic_record_distribution_metric(NULL, "Metric/Dist", 1.0));
+  assert_false(newrelic_record_distribution_metric(txn, NULL, 1.0));
+
+  assert_true(newrelic_record_distribution_metric(txn, "Metric/Dist", 1.0));
+  assert_true(newrelic_record_distribution_metric(txn, "Metric/Dist", 3.0));
+  assert_non_null(nrm_get_sketch(
+      txn->txn->unscoped_metrics,
+      nrm_find(txn->txn->unscoped_metrics, "Metric/Dist")));
+}
+
+static void test_record_app_metric(void** state NRUNUSED) {
+  void* app_state = NULL;
+  newrelic_app_t* app;
+  const nr_metric_thread_t* thread;
+  const nrmetric_t* metric;
+
+  app_group_setup(&app_state);
+  app = (newrelic_app_t*)app_state;
+  app->metric_accumulator = nr_metric_accumulator_create();
+
+  assert_false(newrelic_record_app_metric(NULL, "Metric/App", 1.0));
+  assert_false(newrelic_record_app_metric(app, NULL, 1.0));
+  assert_false(newrelic_record_app_metric(app, "Metric/App", NAN));
+  assert_false(newrelic_record_app_metric(app, "Metric/App", INFINITY));
+
+  assert_true(newrelic_record_app_metric(app, "Metric/App", 1.0));
+  assert_true(newrelic_record_app_metric(app, "Metric/App", 3.0));
+
+  /*
+   * The metrics are kept, as the application has not connected; the values
+   * are given in milliseconds and accumulated in microseconds.
+   */
+  thread = app->metric_accumulator->threads;
+  assert_non_null(thread);
+  assert_null(thread->next);
+  metric = nrm_find(thread->active, "Metric/App");
+  assert_non_null(metric);
+  assert_int_equal(2, nrm_count(metric));
+  assert_int_equal(4000, nrm_total(metric));
+  assert_int_equal(1000, nrm_min(metric));
+  assert_int_equal(3000, nrm_max(metric));
+
+  app_group_teardown(&app_state);
+}
+
+static void test_register_custom_metric(void** state NRUNUSED) {
+  void* app_state = NULL;
+  newrelic_app_t* app;
+  newrelic_metric_handle_t* first;
+  newrelic_metric_handle_t* second;
+
+  app_group_setup(&app_state);
+  app = (newrelic_app_t*)app_state;
+
+  assert_null(newrelic_register_custom_metric(NULL, "Metric/First"));
+  assert_null(newrelic_register_custom_metric(app, NULL));
+
+  /* Each name gets the next slot, and keeps it when registered again. */
+  first = newrelic_register_custom_metric(app, "Metric/First");
+  second = newrelic_register_custom_metric(app, "Metric/Second");
+  assert_non_null(first);
+  assert_non_null(second);
+  assert_string_equal("Metric/First", first->name);
+  assert_int_equal(0, first->slot);
+  assert_int_equal(1, second->slot);
+  assert_ptr_equal(first, newrelic_register_custom_metric(app, "Metric/First"));
+
+  app_group_teardown(&app_state);
+}
+
+static void test_record_custom_metric_handle(void** state) {
+  newrelic_txn_t* txn = (newrelic_txn_t*)*state;
+  newrelic_metric_handle_t handle = {.name = "Metric/Handle", .slot = 2};
+
+  assert_false(newrelic_record_custom_metric_handle(NULL, &handle, 1.0));
+  assert_false(newrelic_record_custom_metric_handle(txn, NULL, 1.0));
+
+  assert_true(newrelic_record_custom_metric_handle(txn, &handle, 1.0));
+  assert_true(newrelic_record_custom_metric_handle(txn, &handle, 3.0));
+  assert_true(txn->txn->num_metric_slots > handle.slot);
+  assert_int_equal(2, txn->txn->metric_slots[handle.slot].count);
+  assert_ptr_equal(handle.name, txn->txn->metric_slots[handle.slot].name);
+}
+
+static void test_record_custom_metric_handle_other_app(void** state) {
+  newrelic_txn_t* txn = (newrelic_txn_t*)*state;
+  void* app_state = NULL;
+  void* other_state = NULL;
+  newrelic_metric_handle_t* handle;
+
+  app_group_setup(&app_state);
+  app_group_setup(&other_state);
+  handle = newrelic_register_custom_metric((newrelic_app_t*)app_state,
+                                           "Metric/Registered");
+
+  /* Both applications number their slots from 0. */
+  txn->owner = (newrelic_app_t*)other_state;
+  assert_false(newrelic_record_custom_metric_handle(txn, handle, 1.0));
+
+  txn->owner = (newrelic_app_t*)app_state;
+  assert_true(newrelic_record_custom_metric_handle(txn, handle, 1.0));
+  assert_ptr_equal(handle->name, txn->txn->metric_slots[handle->slot].name);
+
+  /* The slot must not refer to the handle once the application is gone. */
+  txn->txn->metric_slots[handle->slot].count = 0;
+  txn->owner = NULL;
+  app_group_teardown(&app_state);
+  app_group_teardown(&other_state);
+}
+
 int main(void) {
   const struct CMUnitTest metric_tests[] = {
       cmocka_unit_test(test_custom_metric_inputs),
+      cmocka_unit_test(test_record_distribution_metric),
+      cmocka_unit_test(test_record_app_metric),
+      cmocka_unit_test(test_register_custom_metric),
+      cmocka_unit_test(test_record_custom_metric_handle),
+      cmocka_unit_test(test_record_custom_metric_handle_other_app),
   };
 
   return cmocka_run_group_tests(metric_tests, txn_group_setup,
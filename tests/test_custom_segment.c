@@ -9,6 +9,7 @@
 #include "transaction.h"
 #include "util_memory.h"
 #include "util_sleep.h"
+#include "util_strings.h"
 #include "util_vector.h"
 
 #include "test.h"
@@ -117,6 +118,57 @@ static void test_end_segment_free(void** state) {
   assert_null(seg);
 }
 
+/*
+ * Purpose: Test that segment handles are reused once ended.
+ */
+static void test_end_segment_reuse(void** state) {
+  newrelic_txn_t* txn = (newrelic_txn_t*)*state;
+  newrelic_segment_t* seg = newrelic_start_segment(txn, NULL, NULL);
+  newrelic_segment_t* first = seg;
+  newrelic_segment_t* other;
+
+  assert_non_null(newrelic_end_segment(txn, &seg));
+  assert_ptr_equal(first, txn->free_segments);
+
+  /* The ended axiom segment may be folded and reused, so the handle lets go
+   * of it. */
+  assert_null(first->segment);
+
+  seg = newrelic_start_segment(txn, "a", "b");
+  assert_ptr_equal(first, seg);
+  assert_null(txn->free_segments);
+  assert_ptr_equal(txn, seg->owner);
+  assert_null(seg->next);
+
+  other = newrelic_start_segment(txn, "c", "d");
+  assert_ptr_not_equal(seg, other);
+
+  assert_non_null(newrelic_end_segment(txn, &seg));
+  assert_non_null(newrelic_end_segment(txn, &other));
+}
+
+/*
+ * Purpose: Test that newrelic_start_segment() names segments that are too
+ * long for the name buffer.
+ */
+static void test_start_segment_long_name(void** state) {
+  newrelic_txn_t* txn = (newrelic_txn_t*)*state;
+  char name[1024];
+  char* expected;
+  newrelic_segment_t* seg;
+
+  nr_memset(name, 'a', sizeof(name) - 1);
+  name[sizeof(name) - 1] = '\0';
+  expected = nr_formatf("Custom/%s", name);
+
+  seg = newrelic_start_segment(txn, name, NULL);
+  assert_string_equal(
+      expected, nr_string_get(txn->txn->trace_strings, seg->segment->name));
+
+  newrelic_segment_destroy(&seg);
+  nr_free(expected);
+}
+
 /*
  * Purpose: Test that newrelic_end_segment() updates metrics
  * and trace nodes in the transaction.
@@ -130,6 +182,130 @@ static void test_end_segment_metric_trace(void** state) {
   assert_int_equal(1, nr_vector_size(segment->metrics));
 }
 
+/*
+ * Purpose: Test that custom segments are recorded into per-thread buffers
+ * when the transaction has them enabled.
+ */
+static void test_segment_thread_buffers(void** state) {
+  newrelic_txn_t* txn = (newrelic_txn_t*)*state;
+  newrelic_segment_t* outer;
+  newrelic_segment_t* inner;
+  newrelic_segment_t* locked;
+  nr_segment_record_t* outer_record;
+  nr_segment_record_t* inner_record;
+
+  assert_true(
+      nr_txn_enable_segment_records(txn->txn, sizeof(newrelic_segment_t)));
+
+  outer = newrelic_start_segment(txn, "outer", NULL);
+  inner = newrelic_start_segment(txn, "inner", "Category");
+  assert_non_null(outer);
+  assert_null(outer->segment);
+  assert_ptr_equal(&outer->record, inner->record.parent);
+  outer_record = &outer->record;
+  inner_record = &inner->record;
+
+  /* Buffered segments cannot be parented to locked ones, and vice versa. */
+  nrt_mutex_lock(&txn->lock);
+  locked = newrelic_segment_create(txn);
+  nrt_mutex_unlock(&txn->lock);
+  assert_false(newrelic_set_segment_parent(inner, locked));
+  assert_false(newrelic_set_segment_parent(locked, inner));
+  newrelic_segment_destroy(&locked);
+
+  assert_true(newrelic_set_segment_parent_root(inner));
+  assert_true(newrelic_set_segment_parent(inner, outer));
+  assert_true(newrelic_set_segment_timing(inner, 10, 5));
+
+  assert_true(newrelic_end_segment(txn, &inner));
+  assert_null(inner);
+  assert_true(newrelic_end_segment(txn, &outer));
+
+  /* Nothing is added to the segment tree until the transaction ends. */
+  assert_int_equal(0, txn->txn->segment_count);
+  nr_segment_records_assemble(txn->txn);
+
+  assert_ptr_equal(txn->txn->segment_root, outer_record->segment->parent);
+  assert_ptr_equal(outer_record->segment, inner_record->segment->parent);
+  assert_string_equal("Category/inner",
+                      nr_string_get(txn->txn->trace_strings,
+                                    inner_record->segment->name));
+  assert_int_equal(10, inner_record->segment->start_time);
+  assert_int_equal(15, inner_record->segment->stop_time);
+  assert_int_equal(1, nr_vector_size(inner_record->segment->metrics));
+}
+
+/*
+ * Purpose: Test that newrelic_record_segments() records pre-timed segments of
+ * every type, and skips invalid records.
+ */
+static void test_record_segments(void** state) {
+  newrelic_txn_t* txn = (newrelic_txn_t*)*state;
+  nr_segment_t* root = txn->txn->segment_root;
+  nr_segment_t* segment;
+  newrelic_datastore_segment_params_t datastore
+      = {.product = NEWRELIC_DATASTORE_MYSQL, .collection = "users"};
+  newrelic_datastore_segment_params_t invalid_datastore = {.product = NULL};
+  newrelic_external_segment_params_t external
+      = {.uri = "https://example.com/", .procedure = "GET"};
+  const newrelic_segment_record_t records[] = {
+      {.name = "loop", .start_time = 10, .duration = 5},
+      {.name = "a/b", .category = "c/d", .start_time = 20, .duration = 5},
+      {.start_time = 30, .duration = 5, .datastore = &datastore},
+      {.start_time = 40, .duration = 5, .external = &external},
+      {.start_time = 50, .duration = 5, .datastore = &invalid_datastore},
+  };
+
+  assert_int_equal(0, newrelic_record_segments(NULL, NULL, records, 1));
+  assert_int_equal(0, newrelic_record_segments(txn, NULL, NULL, 1));
+  assert_int_equal(0, newrelic_record_segments(txn, NULL, records, 0));
+
+  assert_int_equal(4, newrelic_record_segments(txn, NULL, records, 5));
+  assert_int_equal(4, nr_segment_children_size(&root->children));
+  assert_int_equal(4, txn->txn->segment_count);
+
+  segment = nr_segment_children_get(&root->children, 0);
+  assert_string_equal("Custom/loop",
+                      nr_string_get(txn->txn->trace_strings, segment->name));
+  assert_int_equal(10, segment->start_time);
+  assert_int_equal(15, segment->stop_time);
+  assert_int_equal(1, nr_vector_size(segment->metrics));
+
+  segment = nr_segment_children_get(&root->children, 1);
+  assert_string_equal("Custom/Unnamed Segment",
+                      nr_string_get(txn->txn->trace_strings, segment->name));
+
+  segment = nr_segment_children_get(&root->children, 2);
+  assert_int_equal(NR_SEGMENT_DATASTORE, segment->type);
+  assert_int_equal(35, segment->stop_time);
+
+  segment = nr_segment_children_get(&root->children, 3);
+  assert_int_equal(NR_SEGMENT_EXTERNAL, segment->type);
+  assert_int_equal(45, segment->stop_time);
+}
+
+/*
+ * Purpose: Test that newrelic_record_segments() records segments under the
+ * given parent, which cannot be a buffered segment.
+ */
+static void test_record_segments_parent(void** state) {
+  newrelic_txn_t* txn = (newrelic_txn_t*)*state;
+  newrelic_segment_t* parent = newrelic_start_segment(txn, "parent", NULL);
+  newrelic_segment_t* buffered;
+  const newrelic_segment_record_t record
+      = {.name = "child", .start_time = 10, .duration = 5};
+
+  assert_int_equal(1, newrelic_record_segments(txn, parent, &record, 1));
+  assert_int_equal(1, nr_segment_children_size(&parent->segment->children));
+  newrelic_end_segment(txn, &parent);
+
+  assert_true(
+      nr_txn_enable_segment_records(txn->txn, sizeof(newrelic_segment_t)));
+  buffered = newrelic_start_segment(txn, "buffered", NULL);
+  assert_int_equal(0, newrelic_record_segments(txn, buffered, &record, 1));
+  newrelic_end_segment(txn, &buffered);
+}
+
 /*
  * Purpose: Main entry point (i.e. runs the tests)
  */
@@ -147,8 +323,18 @@ int main(void) {
                                       txn_group_teardown),
       cmocka_unit_test_setup_teardown(test_end_segment_free, txn_group_setup,
                                       txn_group_teardown),
+      cmocka_unit_test_setup_teardown(test_end_segment_reuse, txn_group_setup,
+                                      txn_group_teardown),
+      cmocka_unit_test_setup_teardown(test_start_segment_long_name,
+                                      txn_group_setup, txn_group_teardown),
       cmocka_unit_test_setup_teardown(test_end_segment_metric_trace,
                                       txn_group_setup, txn_group_teardown),
+      cmocka_unit_test_setup_teardown(test_segment_thread_buffers,
+                                      txn_group_setup, txn_group_teardown),
+      cmocka_unit_test_setup_teardown(test_record_segments, txn_group_setup,
+                                      txn_group_teardown),
+      cmocka_unit_test_setup_teardown(test_record_segments_parent,
+                                      txn_group_setup, txn_group_teardown),
   };
 
   return cmocka_run_group_tests(segment_tests, NULL, NULL);
@@ -16,7 +16,7 @@
 
 /* Create a datastore segment interesting enough for testing purposes */
 static newrelic_segment_t* mock_datastore_segment(newrelic_txn_t* txn) {
-  newrelic_segment_t* segment = newrelic_segment_create(txn->txn);
+  newrelic_segment_t* segment = newrelic_segment_create(txn);
 
   segment->segment->type = NR_SEGMENT_DATASTORE;
 
@@ -8,7 +8,10 @@
 
 #include "libnewrelic.h"
 #include "test.h"
+#include "nr_metric_aggregate.h"
 #include "nr_txn.h"
+#include "segment.h"
+#include "sender.h"
 #include "transaction.h"
 #include "util_memory.h"
 #include "util_strings.h"
@@ -16,6 +19,7 @@
 /* Declare prototypes for mocks */
 nr_status_t __wrap_nr_cmd_txndata_tx(int daemon_fd, const nrtxn_t* txn);
 void __wrap_nr_txn_end(nrtxn_t* txn_end);
+bool __wrap_newrelic_sender_enqueue(nrtxn_t* txn);
 
 /**
  * Purpose: Mock to catch transaction calls to the daemon.  The mock()
@@ -34,8 +38,15 @@ void __wrap_nr_txn_end(nrtxn_t* txn_end) {
   assert_non_null(metric_exists);
 }
 
+/**
+ * Purpose: Mock to catch transactions handed to the background sender.
+ */
+bool __wrap_newrelic_sender_enqueue(nrtxn_t* txn NRUNUSED) {
+  return (bool)mock();
+}
+
 static newrelic_txn_t* mock_txn(void) {
-  newrelic_txn_t* txn = nr_malloc(sizeof(newrelic_txn_t));
+  newrelic_txn_t* txn = nr_zalloc(sizeof(newrelic_txn_t));
 
   nrt_mutex_init(&txn->lock, 0);
   txn->txn = nr_zalloc(sizeof(nrtxn_t));
@@ -111,6 +122,106 @@ static void test_end_transaction_check_metrics(void** state NRUNUSED) {
   destroy_mock_txn(&txn);
 }
 
+static void test_end_transaction_async_queued(void** state NRUNUSED) {
+  bool ret;
+  newrelic_txn_t* txn = mock_txn();
+  nrtxn_t* axiom_txn = txn->txn;
+
+  txn->async_send = true;
+  txn->txn->status.ignore = 0;
+  will_return(__wrap_newrelic_sender_enqueue, true);
+
+  /* The transaction is queued rather than sent from this thread. */
+  ret = newrelic_end_transaction(&txn);
+  assert_true(ret);
+  assert_null(txn);
+
+  /* The mocked sender owns the transaction now, so clean it up here. */
+  nr_txn_destroy(&axiom_txn);
+}
+
+static void test_end_transaction_async_queue_full(void** state NRUNUSED) {
+  bool ret;
+  newrelic_txn_t* txn = mock_txn();
+
+  txn->async_send = true;
+  txn->txn->status.ignore = 0;
+  will_return(__wrap_newrelic_sender_enqueue, false);
+  will_return(__wrap_nr_cmd_txndata_tx, NR_SUCCESS);
+
+  /* A full queue falls back to sending from this thread. */
+  ret = newrelic_end_transaction(&txn);
+  assert_true(ret);
+  destroy_mock_txn(&txn);
+}
+
+static void test_end_transaction_aggregates_metrics(void** state NRUNUSED) {
+  bool ret;
+  newrelic_txn_t* txn = mock_txn();
+  nrtxn_t* axiom_txn = txn->txn;
+  nr_metric_aggregate_t* aggregate = nr_metric_aggregate_create();
+
+  txn->async_send = true;
+  txn->metric_aggregate = aggregate;
+  txn->txn->status.ignore = 0;
+  txn->txn->name = nr_strdup("WebTransaction/Action/test");
+  txn->txn->agent_run_id = nr_strdup("12345678");
+  txn->txn->scoped_metrics = nrm_table_create(NR_METRIC_DEFAULT_LIMIT);
+  will_return(__wrap_newrelic_sender_enqueue, true);
+
+  /* The metrics are left in the aggregate, and the transaction is sent
+   * without them. */
+  ret = newrelic_end_transaction(&txn);
+  assert_true(ret);
+  assert_int_equal(0, nrm_table_size(axiom_txn->unscoped_metrics));
+
+  nr_txn_destroy(&axiom_txn);
+  nr_metric_aggregate_destroy(&aggregate);
+}
+
+/*
+ * Purpose: Test that segment handles that are still held when their
+ * transaction ends can be ended afterwards.
+ */
+static void test_end_transaction_segment_after(void** state NRUNUSED) {
+  newrelic_txn_t* txn;
+  newrelic_segment_t* ended;
+  newrelic_segment_t* seg;
+  newrelic_segment_t* other;
+  newrelic_datastore_segment_params_t params = {
+      .product = NEWRELIC_DATASTORE_MYSQL,
+      .collection = "users",
+      .operation = "select",
+  };
+
+  txn_group_setup((void**)&txn);
+
+  /* One handle is waiting to be reused when the transaction ends. */
+  ended = newrelic_start_segment(txn, "ended", NULL);
+  assert_true(newrelic_end_segment(txn, &ended));
+
+  seg = newrelic_start_datastore_segment(txn, &params);
+  other = newrelic_start_segment(txn, "live", NULL);
+  assert_non_null(seg);
+  assert_non_null(other);
+
+  txn->txn->status.ignore = 1;
+  assert_true(newrelic_end_transaction(&txn));
+  assert_null(txn);
+
+  /* The handles no longer refer to the transaction. */
+  assert_null(seg->owner);
+  assert_null(seg->transaction);
+  assert_null(seg->segment);
+  assert_false(newrelic_set_segment_timing(other, 0, 10));
+  assert_false(newrelic_set_segment_parent(other, seg));
+
+  assert_false(newrelic_end_segment(txn, &seg));
+  assert_null(seg);
+  assert_false(newrelic_end_segment(txn, &other));
+  assert_null(other);
+}
+
 int main(void) {
   const struct CMUnitTest transaction_tests[] = {
       cmocka_unit_test(test_end_transaction_null),
@@ -119,6 +230,10 @@ int main(void) {
       cmocka_unit_test(test_end_transaction_ignored_success),
       cmocka_unit_test(test_end_transaction_valid),
       cmocka_unit_test(test_end_transaction_check_metrics),
+      cmocka_unit_test(test_end_transaction_async_queued),
+      cmocka_unit_test(test_end_transaction_async_queue_full),
+      cmocka_unit_test(test_end_transaction_aggregates_metrics),
+      cmocka_unit_test(test_end_transaction_segment_after),
   };
 
   return cmocka_run_group_tests(transaction_tests, NULL, NULL);
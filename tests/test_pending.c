@@ -0,0 +1,164 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "libnewrelic.h"
+#include "pending.h"
+#include "test.h"
+#include "nr_app.h"
+#include "nr_txn.h"
+#include "util_memory.h"
+#include "util_metrics.h"
+
+/* Declare prototypes for mocks */
+nr_status_t __wrap_nr_txn_apply_connect_info(nrtxn_t* txn, const nrapp_t* app);
+void __wrap_nr_txn_end(nrtxn_t* txn);
+bool __wrap_newrelic_send_transaction(nrtxn_t** txn_ptr, bool async_send);
+
+static int ended = 0;
+static int sent = 0;
+static nrtime_t sent_dropped = 0;
+
+nr_status_t __wrap_nr_txn_apply_connect_info(nrtxn_t* txn NRUNUSED,
+                                             const nrapp_t* app) {
+  return (NR_APP_OK == app->state) ? NR_SUCCESS : NR_FAILURE;
+}
+
+void __wrap_nr_txn_end(nrtxn_t* txn NRUNUSED) {
+  ended += 1;
+}
+
+/**
+ * Purpose: Mock to count the transactions sent, and the drops reported with
+ * them.
+ */
+bool __wrap_newrelic_send_transaction(nrtxn_t** txn_ptr,
+                                      bool async_send NRUNUSED) {
+  nrmetric_t* metric = nrm_find((*txn_ptr)->unscoped_metrics,
+                                "Supportability/C/Startup/Dropped");
+
+  if (metric) {
+    sent_dropped += nrm_count(metric);
+  }
+  sent += 1;
+  nr_txn_destroy(txn_ptr);
+
+  return true;
+}
+
+static nrtxn_t* mock_txn(void) {
+  nrtxn_t* txn = nr_zalloc(sizeof(nrtxn_t));
+
+  txn->unscoped_metrics = nrm_table_create(NR_METRIC_DEFAULT_LIMIT);
+
+  return txn;
+}
+
+static void reset_counts(void) {
+  ended = 0;
+  sent = 0;
+  sent_dropped = 0;
+}
+
+static void test_pending_invalid(void** state NRUNUSED) {
+  nrapp_t app = {.state = NR_APP_UNKNOWN};
+  nrtxn_t* txn = mock_txn();
+  newrelic_pending_t* pending = NULL;
+
+  assert_null(newrelic_pending_create(0, false));
+
+  assert_false(newrelic_pending_add(NULL, &app, txn));
+  assert_false(newrelic_pending_connect(NULL, txn));
+  assert_false(newrelic_pending_connect(&app, NULL));
+  newrelic_pending_replay(NULL, &app);
+  newrelic_pending_destroy(NULL);
+  newrelic_pending_destroy(&pending);
+
+  nr_txn_destroy(&txn);
+}
+
+static void test_pending_replay(void** state NRUNUSED) {
+  nrapp_t app = {.state = NR_APP_UNKNOWN};
+  newrelic_pending_t* pending = newrelic_pending_create(2, false);
+  nrtxn_t* ignored = mock_txn();
+
+  reset_counts();
+  nrt_mutex_init(&app.app_lock, 0);
+
+  /*
+   * Transactions that end before the application connects are held, up to
+   * the capacity; ignored ones are discarded.
+   */
+  ignored->status.ignore = 1;
+  assert_true(newrelic_pending_add(pending, &app, ignored));
+  assert_true(newrelic_pending_add(pending, &app, mock_txn()));
+  assert_true(newrelic_pending_add(pending, &app, mock_txn()));
+  assert_true(newrelic_pending_add(pending, &app, mock_txn()));
+
+  /* Nothing is sent until the application has connected. */
+  newrelic_pending_replay(pending, &app);
+  assert_int_equal(0, sent);
+
+  app.state = NR_APP_OK;
+  newrelic_pending_replay(pending, &app);
+  assert_int_equal(2, ended);
+  assert_int_equal(2, sent);
+  assert_int_equal(1, sent_dropped);
+
+  /* Once connected, transactions are left with the caller. */
+  {
+    nrtxn_t* txn = mock_txn();
+
+    assert_false(newrelic_pending_add(pending, &app, txn));
+    assert_true(newrelic_pending_connect(&app, txn));
+    assert_int_equal(3, ended);
+    nr_txn_destroy(&txn);
+  }
+
+  newrelic_pending_replay(pending, &app);
+  assert_int_equal(2, sent);
+
+  newrelic_pending_destroy(&pending);
+  assert_null(pending);
+  nrt_mutex_destroy(&app.app_lock);
+}
+
+static void test_pending_invalid_app(void** state NRUNUSED) {
+  nrapp_t app = {.state = NR_APP_UNKNOWN};
+  newrelic_pending_t* pending = newrelic_pending_create(10, false);
+
+  reset_counts();
+  nrt_mutex_init(&app.app_lock, 0);
+
+  /*
+   * Transactions held for an application that fails to connect are
+   * discarded, as are those ending afterwards.
+   */
+  assert_true(newrelic_pending_add(pending, &app, mock_txn()));
+  app.state = NR_APP_INVALID;
+  assert_true(newrelic_pending_add(pending, &app, mock_txn()));
+  newrelic_pending_replay(pending, &app);
+  assert_int_equal(0, ended);
+  assert_int_equal(0, sent);
+
+  /* Transactions still held are discarded with the set. */
+  app.state = NR_APP_UNKNOWN;
+  assert_true(newrelic_pending_add(pending, &app, mock_txn()));
+  newrelic_pending_destroy(&pending);
+  assert_int_equal(0, sent);
+
+  nrt_mutex_destroy(&app.app_lock);
+}
+
+int main(void) {
+  const struct CMUnitTest pending_tests[] = {
+      cmocka_unit_test(test_pending_invalid),
+      cmocka_unit_test(test_pending_replay),
+      cmocka_unit_test(test_pending_invalid_app),
+  };
+
+  return cmocka_run_group_tests(pending_tests, NULL, NULL);
+}
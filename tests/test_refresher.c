@@ -0,0 +1,122 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "libnewrelic.h"
+#include "refresher.h"
+#include "test.h"
+#include "nr_app.h"
+#include "util_memory.h"
+#include "util_threads.h"
+#include "util_time.h"
+
+/* Declare prototypes for mocks */
+bool __wrap_nr_app_refresh_appinfo(nrapp_t* app, time_t now);
+
+static nrthread_mutex_t refresh_mutex = NRTHREAD_MUTEX_INITIALIZER;
+static nrthread_cond_t refresh_cond = NRTHREAD_COND_INITIALIZER;
+static nrapp_t* refreshed_app = NULL;
+static int refresh_count = 0;
+
+/**
+ * Purpose: Mock to count the queries made by the refresher thread.
+ */
+bool __wrap_nr_app_refresh_appinfo(nrapp_t* app, time_t now NRUNUSED) {
+  nrt_mutex_lock(&refresh_mutex);
+  refreshed_app = app;
+  refresh_count += 1;
+  nrt_cond_broadcast(&refresh_cond);
+  nrt_mutex_unlock(&refresh_mutex);
+
+  return true;
+}
+
+static void test_refresher_invalid(void** state NRUNUSED) {
+  newrelic_refresher_t* refresher = NULL;
+
+  assert_null(newrelic_refresher_start(NULL, NULL, NULL));
+
+  /* Stopping a refresher that was never started is harmless. */
+  newrelic_refresher_stop(NULL);
+  newrelic_refresher_stop(&refresher);
+}
+
+/**
+ * Purpose: Callback to count the refresher's calls after each query.
+ */
+static void refreshed(nrapp_t* app, void* userdata) {
+  int* calls = (int*)userdata;
+
+  nrt_mutex_lock(&refresh_mutex);
+  assert_ptr_equal(refreshed_app, app);
+  *calls += 1;
+  nrt_cond_broadcast(&refresh_cond);
+  nrt_mutex_unlock(&refresh_mutex);
+}
+
+static void test_refresher_refreshes(void** state NRUNUSED) {
+  nrapp_t app;
+  newrelic_refresher_t* refresher;
+  nrtime_t start;
+
+  nrt_mutex_lock(&refresh_mutex);
+  refreshed_app = NULL;
+  refresh_count = 0;
+  nrt_mutex_unlock(&refresh_mutex);
+
+  refresher = newrelic_refresher_start(&app, NULL, NULL);
+  assert_non_null(refresher);
+
+  /* The first query is considered as soon as the refresher starts. */
+  nrt_mutex_lock(&refresh_mutex);
+  while (0 == refresh_count) {
+    nrt_cond_wait(&refresh_cond, &refresh_mutex);
+  }
+  assert_ptr_equal(&app, refreshed_app);
+  nrt_mutex_unlock(&refresh_mutex);
+
+  /* Stopping does not wait for the next tick. */
+  start = nr_get_time();
+  newrelic_refresher_stop(&refresher);
+  assert_null(refresher);
+  assert_true(nr_time_duration(start, nr_get_time())
+              < 500 * NR_TIME_DIVISOR_MS);
+}
+
+static void test_refresher_callback(void** state NRUNUSED) {
+  nrapp_t app;
+  newrelic_refresher_t* refresher;
+  int calls = 0;
+
+  nrt_mutex_lock(&refresh_mutex);
+  refreshed_app = NULL;
+  refresh_count = 0;
+  nrt_mutex_unlock(&refresh_mutex);
+
+  refresher = newrelic_refresher_start(&app, refreshed, &calls);
+  assert_non_null(refresher);
+
+  /* The callback follows each query. */
+  nrt_mutex_lock(&refresh_mutex);
+  while (0 == calls) {
+    nrt_cond_wait(&refresh_cond, &refresh_mutex);
+  }
+  assert_int_equal(1, refresh_count);
+  nrt_mutex_unlock(&refresh_mutex);
+
+  newrelic_refresher_stop(&refresher);
+  assert_true(calls >= 1);
+}
+
+int main(void) {
+  const struct CMUnitTest refresher_tests[] = {
+      cmocka_unit_test(test_refresher_invalid),
+      cmocka_unit_test(test_refresher_refreshes),
+      cmocka_unit_test(test_refresher_callback),
+  };
+
+  return cmocka_run_group_tests(refresher_tests, NULL, NULL);
+}
@@ -0,0 +1,491 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "libnewrelic.h"
+#include "sender.h"
+#include "test.h"
+#include "nr_distributed_trace.h"
+#include "nr_txn.h"
+#include "util_flatbuffers.h"
+#include "util_memory.h"
+#include "util_metrics.h"
+#include "util_sleep.h"
+#include "util_strings.h"
+#include "util_threads.h"
+
+/* Declare prototypes for mocks */
+nr_status_t __wrap_nr_cmd_txndata_tx(int daemon_fd, const nrtxn_t* txn);
+nr_flatbuffer_t* __wrap_nr_cmd_txndata_encode(const nrtxn_t* txn);
+nr_status_t __wrap_nr_cmd_txndata_tx_batch(int daemon_fd,
+                                           nr_flatbuffer_t* const* msgs,
+                                           size_t nmsgs);
+
+/*
+ * State shared between the test thread and the mocked transmit function,
+ * which runs on the sender thread. When gated is true, the mock blocks until
+ * the test clears it, which lets the tests fill the queue deterministically.
+ */
+static nrthread_mutex_t sent_mutex = NRTHREAD_MUTEX_INITIALIZER;
+static nrthread_cond_t sent_cond = NRTHREAD_COND_INITIALIZER;
+static int sent_count = 0;
+static int batch_count = 0;
+static bool in_send = false;
+static bool gated = false;
+
+/*
+ * The priorities of the transactions sent, in order, and the drops reported
+ * by each. When fail_sends is positive, that many sends fail.
+ */
+#define MAX_SENT 16
+static nr_sampling_priority_t sent_priorities[MAX_SENT];
+static int sent_queue_full[MAX_SENT];
+static int sent_send_failed[MAX_SENT];
+static int fail_sends = 0;
+
+#define assert_priority_equal(expected, actual) \
+  assert_int_equal((int)((expected)*1000 + 0.5), (int)((actual)*1000 + 0.5))
+
+static int reported_drops(const nrtxn_t* txn, const char* name) {
+  const nrmetric_t* metric = nrm_find(txn->unscoped_metrics, name);
+
+  return metric ? (int)nrm_count(metric) : 0;
+}
+
+/**
+ * Purpose: Mock to count transactions sent to the daemon by the sender
+ * thread.
+ */
+nr_status_t __wrap_nr_cmd_txndata_tx(int daemon_fd NRUNUSED,
+                                     const nrtxn_t* txn) {
+  nr_status_t st = NR_SUCCESS;
+
+  nrt_mutex_lock(&sent_mutex);
+  in_send = true;
+  nrt_cond_broadcast(&sent_cond);
+  while (gated) {
+    nrt_cond_wait(&sent_cond, &sent_mutex);
+  }
+  if (fail_sends > 0) {
+    fail_sends -= 1;
+    st = NR_FAILURE;
+  } else {
+    if (sent_count < MAX_SENT) {
+      sent_priorities[sent_count]
+          = nr_distributed_trace_get_priority(txn->distributed_trace);
+      sent_queue_full[sent_count] = reported_drops(
+          txn, "Supportability/C/Sender/Dropped/QueueFull");
+      sent_send_failed[sent_count] = reported_drops(
+          txn, "Supportability/C/Sender/Dropped/SendFailed");
+    }
+    sent_count += 1;
+  }
+  in_send = false;
+  nrt_cond_broadcast(&sent_cond);
+  nrt_mutex_unlock(&sent_mutex);
+
+  return st;
+}
+
+/**
+ * Purpose: Mock to avoid encoding the empty mock transactions.
+ */
+nr_flatbuffer_t* __wrap_nr_cmd_txndata_encode(const nrtxn_t* txn NRUNUSED) {
+  return nr_flatbuffers_create(0);
+}
+
+/**
+ * Purpose: Mock to count batches, and the transactions in them, sent to the
+ * daemon by the sender thread.
+ */
+nr_status_t __wrap_nr_cmd_txndata_tx_batch(int daemon_fd NRUNUSED,
+                                           nr_flatbuffer_t* const* msgs
+                                               NRUNUSED,
+                                           size_t nmsgs) {
+  nrt_mutex_lock(&sent_mutex);
+  sent_count += (int)nmsgs;
+  batch_count += 1;
+  nrt_mutex_unlock(&sent_mutex);
+
+  return NR_SUCCESS;
+}
+
+static nrtxn_t* mock_txn(void) {
+  nrtxn_t* txn = nr_zalloc(sizeof(nrtxn_t));
+
+  txn->unscoped_metrics = nrm_table_create(NR_METRIC_DEFAULT_LIMIT);
+
+  return txn;
+}
+
+static nrtxn_t* mock_txn_with_priority(nr_sampling_priority_t priority) {
+  nrtxn_t* txn = mock_txn();
+
+  txn->distributed_trace = nr_distributed_trace_create();
+  nr_distributed_trace_set_priority(txn->distributed_trace, priority);
+
+  return txn;
+}
+
+static nrtxn_t* mock_txn_with_run_id(const char* agent_run_id) {
+  nrtxn_t* txn = mock_txn();
+
+  txn->agent_run_id = nr_strdup(agent_run_id);
+
+  return txn;
+}
+
+static int sender_setup(void** state NRUNUSED) {
+  nrt_mutex_lock(&sent_mutex);
+  sent_count = 0;
+  batch_count = 0;
+  in_send = false;
+  gated = false;
+  fail_sends = 0;
+  nrt_mutex_unlock(&sent_mutex);
+
+  return 0;
+}
+
+/*
+ * Block the sender thread inside the send of the first transaction, so that
+ * the queue can be filled deterministically.
+ */
+static void gate_first_send(nrtxn_t* txn) {
+  nrt_mutex_lock(&sent_mutex);
+  gated = true;
+  nrt_mutex_unlock(&sent_mutex);
+
+  assert_true(newrelic_sender_enqueue(txn));
+
+  nrt_mutex_lock(&sent_mutex);
+  while (!in_send) {
+    nrt_cond_wait(&sent_cond, &sent_mutex);
+  }
+  nrt_mutex_unlock(&sent_mutex);
+}
+
+static void open_gate_and_wait(int count) {
+  nrt_mutex_lock(&sent_mutex);
+  gated = false;
+  nrt_cond_broadcast(&sent_cond);
+  while (sent_count < count) {
+    nrt_cond_wait(&sent_cond, &sent_mutex);
+  }
+  nrt_mutex_unlock(&sent_mutex);
+}
+
+static void test_sender_start_invalid(void** state NRUNUSED) {
+  newrelic_sender_config_t config = {.async = true, .queue_size = 0};
+
+  assert_false(newrelic_sender_start(NULL));
+  assert_false(newrelic_sender_start(&config));
+}
+
+static void test_sender_enqueue_not_running(void** state NRUNUSED) {
+  nrtxn_t* txn = mock_txn();
+
+  assert_false(newrelic_sender_enqueue(NULL));
+  assert_false(newrelic_sender_enqueue(txn));
+
+  nr_txn_destroy(&txn);
+
+  /* Stopping a sender that was never started is harmless. */
+  newrelic_sender_stop();
+}
+
+static void test_sender_drains_on_stop(void** state NRUNUSED) {
+  newrelic_sender_config_t config = {.async = true, .queue_size = 16};
+  int i;
+
+  assert_true(newrelic_sender_start(&config));
+
+  /* Starting an already running sender is a no-op. */
+  assert_true(newrelic_sender_start(&config));
+
+  for (i = 0; i < 10; i++) {
+    assert_true(newrelic_sender_enqueue(mock_txn()));
+  }
+
+  newrelic_sender_stop();
+  assert_int_equal(10, sent_count);
+
+  /* Once stopped, transactions are no longer accepted. */
+  {
+    nrtxn_t* txn = mock_txn();
+
+    assert_false(newrelic_sender_enqueue(txn));
+    nr_txn_destroy(&txn);
+  }
+}
+
+static void test_sender_shared(void** state NRUNUSED) {
+  newrelic_sender_config_t config = {.async = true, .queue_size = 16};
+  nrtxn_t* txn = mock_txn();
+
+  /* Two applications start the sender. */
+  assert_true(newrelic_sender_start(&config));
+  assert_true(newrelic_sender_start(&config));
+  assert_true(newrelic_sender_enqueue(mock_txn()));
+
+  /* The sender keeps running until both have released it. */
+  newrelic_sender_release();
+  assert_true(newrelic_sender_enqueue(mock_txn()));
+
+  newrelic_sender_release();
+  assert_int_equal(2, sent_count);
+  assert_false(newrelic_sender_enqueue(txn));
+  nr_txn_destroy(&txn);
+
+  /* Releasing a stopped sender is harmless. */
+  newrelic_sender_release();
+}
+
+static void test_sender_queue_full(void** state NRUNUSED) {
+  newrelic_sender_config_t config = {.async = true, .queue_size = 1};
+  nrtxn_t* rejected = mock_txn();
+
+  assert_true(newrelic_sender_start(&config));
+
+  /* Block the sender thread inside the first send. */
+  nrt_mutex_lock(&sent_mutex);
+  gated = true;
+  nrt_mutex_unlock(&sent_mutex);
+
+  assert_true(newrelic_sender_enqueue(mock_txn()));
+
+  nrt_mutex_lock(&sent_mutex);
+  while (!in_send) {
+    nrt_cond_wait(&sent_cond, &sent_mutex);
+  }
+  nrt_mutex_unlock(&sent_mutex);
+
+  /* One slot is free; the transaction after that is rejected. */
+  assert_true(newrelic_sender_enqueue(mock_txn()));
+  assert_false(newrelic_sender_enqueue(rejected));
+  nr_txn_destroy(&rejected);
+
+  nrt_mutex_lock(&sent_mutex);
+  gated = false;
+  nrt_cond_broadcast(&sent_cond);
+  nrt_mutex_unlock(&sent_mutex);
+
+  newrelic_sender_stop();
+  assert_int_equal(2, sent_count);
+}
+
+static void test_sender_drop_newest(void** state NRUNUSED) {
+  newrelic_sender_config_t config = {
+      .async = true, .queue_size = 1, .drop_policy = NEWRELIC_DROP_NEWEST};
+
+  assert_true(newrelic_sender_start(&config));
+
+  gate_first_send(mock_txn_with_priority(0.1));
+  assert_true(newrelic_sender_enqueue(mock_txn_with_priority(0.2)));
+
+  /* The queue is full: the new transaction is taken, and dropped. */
+  assert_true(newrelic_sender_enqueue(mock_txn_with_priority(0.3)));
+  open_gate_and_wait(2);
+
+  assert_true(newrelic_sender_enqueue(mock_txn_with_priority(0.4)));
+  newrelic_sender_stop();
+
+  /* The drop is reported once, with the next transaction sent. */
+  assert_int_equal(3, sent_count);
+  assert_priority_equal(0.1, sent_priorities[0]);
+  assert_priority_equal(0.2, sent_priorities[1]);
+  assert_priority_equal(0.4, sent_priorities[2]);
+  assert_int_equal(0, sent_queue_full[0]);
+  assert_int_equal(1, sent_queue_full[1]);
+  assert_int_equal(0, sent_queue_full[2]);
+}
+
+static void test_sender_drop_oldest(void** state NRUNUSED) {
+  newrelic_sender_config_t config = {
+      .async = true, .queue_size = 1, .drop_policy = NEWRELIC_DROP_OLDEST};
+
+  assert_true(newrelic_sender_start(&config));
+
+  gate_first_send(mock_txn_with_priority(0.1));
+  assert_true(newrelic_sender_enqueue(mock_txn_with_priority(0.2)));
+  assert_true(newrelic_sender_enqueue(mock_txn_with_priority(0.3)));
+  open_gate_and_wait(2);
+
+  newrelic_sender_stop();
+
+  /* The transaction that was replaced is the one dropped. */
+  assert_int_equal(2, sent_count);
+  assert_priority_equal(0.1, sent_priorities[0]);
+  assert_priority_equal(0.3, sent_priorities[1]);
+  assert_int_equal(1, sent_queue_full[1]);
+}
+
+static void test_sender_drop_lowest_priority(void** state NRUNUSED) {
+  newrelic_sender_config_t config = {.async = true,
+                                     .queue_size = 3,
+                                     .drop_policy
+                                     = NEWRELIC_DROP_LOWEST_PRIORITY};
+
+  assert_true(newrelic_sender_start(&config));
+
+  gate_first_send(mock_txn_with_priority(0.1));
+  assert_true(newrelic_sender_enqueue(mock_txn_with_priority(0.5)));
+  assert_true(newrelic_sender_enqueue(mock_txn_with_priority(0.2)));
+  assert_true(newrelic_sender_enqueue(mock_txn_with_priority(0.6)));
+
+  /* 0.2 is evicted; then the new transaction is itself the lowest. */
+  assert_true(newrelic_sender_enqueue(mock_txn_with_priority(0.9)));
+  assert_true(newrelic_sender_enqueue(mock_txn_with_priority(0.15)));
+  open_gate_and_wait(4);
+
+  assert_true(newrelic_sender_enqueue(mock_txn_with_priority(0.3)));
+  newrelic_sender_stop();
+
+  /* The remaining transactions keep their order. */
+  assert_int_equal(5, sent_count);
+  assert_priority_equal(0.1, sent_priorities[0]);
+  assert_priority_equal(0.5, sent_priorities[1]);
+  assert_priority_equal(0.6, sent_priorities[2]);
+  assert_priority_equal(0.9, sent_priorities[3]);
+  assert_priority_equal(0.3, sent_priorities[4]);
+  assert_int_equal(2, sent_queue_full[1] + sent_queue_full[2]
+                          + sent_queue_full[3] + sent_queue_full[4]);
+}
+
+static void test_sender_send_failed(void** state NRUNUSED) {
+  newrelic_sender_config_t config = {.async = true, .queue_size = 16};
+
+  nrt_mutex_lock(&sent_mutex);
+  fail_sends = 2;
+  nrt_mutex_unlock(&sent_mutex);
+
+  assert_true(newrelic_sender_start(&config));
+  assert_true(newrelic_sender_enqueue(mock_txn()));
+  assert_true(newrelic_sender_enqueue(mock_txn()));
+  assert_true(newrelic_sender_enqueue(mock_txn()));
+  newrelic_sender_stop();
+
+  /*
+   * The second failure also carried the report of the first, which is
+   * reported again along with it.
+   */
+  assert_int_equal(1, sent_count);
+  assert_int_equal(2, sent_send_failed[0]);
+}
+
+static void test_sender_drops_on_stop(void** state NRUNUSED) {
+  newrelic_sender_config_t config = {.async = true, .queue_size = 16};
+
+  nrt_mutex_lock(&sent_mutex);
+  fail_sends = 1;
+  nrt_mutex_unlock(&sent_mutex);
+
+  /*
+   * The last transaction fails, leaving a drop no later transaction can
+   * carry: it is sent on its own, under the transaction's agent run.
+   */
+  assert_true(newrelic_sender_start(&config));
+  assert_true(newrelic_sender_enqueue(mock_txn_with_run_id("12345")));
+  newrelic_sender_stop();
+  assert_int_equal(1, sent_count);
+  assert_int_equal(1, batch_count);
+
+  /* Without an agent run to send it under, the drop is only logged. */
+  nrt_mutex_lock(&sent_mutex);
+  fail_sends = 1;
+  nrt_mutex_unlock(&sent_mutex);
+
+  assert_true(newrelic_sender_start(&config));
+  assert_true(newrelic_sender_enqueue(mock_txn()));
+  newrelic_sender_stop();
+  assert_int_equal(1, sent_count);
+  assert_int_equal(1, batch_count);
+}
+
+static void test_sender_batch_size(void** state NRUNUSED) {
+  newrelic_sender_config_t config = {.async = true,
+                                     .queue_size = 16,
+                                     .batch_size = 4,
+                                     .batch_timeout_ms = 60000};
+  int i;
+
+  assert_true(newrelic_sender_start(&config));
+
+  for (i = 0; i < 8; i++) {
+    assert_true(newrelic_sender_enqueue(mock_txn()));
+  }
+
+  /* Two full batches; nothing is left over to flush on stop. */
+  newrelic_sender_stop();
+  assert_int_equal(8, sent_count);
+  assert_int_equal(2, batch_count);
+}
+
+static void test_sender_batch_timeout(void** state NRUNUSED) {
+  newrelic_sender_config_t config = {.async = true,
+                                     .queue_size = 16,
+                                     .batch_size = 100,
+                                     .batch_timeout_ms = 10};
+  int i;
+  int sent = 0;
+
+  assert_true(newrelic_sender_start(&config));
+
+  for (i = 0; i < 3; i++) {
+    assert_true(newrelic_sender_enqueue(mock_txn()));
+  }
+
+  /* The partial batch is flushed once it is old enough. */
+  for (i = 0; (i < 1000) && (3 != sent); i++) {
+    nr_msleep(5);
+    nrt_mutex_lock(&sent_mutex);
+    sent = sent_count;
+    nrt_mutex_unlock(&sent_mutex);
+  }
+  assert_int_equal(3, sent);
+
+  newrelic_sender_stop();
+  assert_int_equal(3, sent_count);
+}
+
+static void test_sender_batch_flush_on_stop(void** state NRUNUSED) {
+  newrelic_sender_config_t config = {.async = true,
+                                     .queue_size = 16,
+                                     .batch_size = 100,
+                                     .batch_timeout_ms = 60000};
+  int i;
+
+  assert_true(newrelic_sender_start(&config));
+
+  for (i = 0; i < 5; i++) {
+    assert_true(newrelic_sender_enqueue(mock_txn()));
+  }
+
+  newrelic_sender_stop();
+  assert_int_equal(5, sent_count);
+  assert_int_equal(1, batch_count);
+}
+
+int main(void) {
+  const struct CMUnitTest sender_tests[] = {
+      cmocka_unit_test_setup(test_sender_start_invalid, sender_setup),
+      cmocka_unit_test_setup(test_sender_enqueue_not_running, sender_setup),
+      cmocka_unit_test_setup(test_sender_drains_on_stop, sender_setup),
+      cmocka_unit_test_setup(test_sender_shared, sender_setup),
+      cmocka_unit_test_setup(test_sender_queue_full, sender_setup),
+      cmocka_unit_test_setup(test_sender_drop_newest, sender_setup),
+      cmocka_unit_test_setup(test_sender_drop_oldest, sender_setup),
+      cmocka_unit_test_setup(test_sender_drop_lowest_priority, sender_setup),
+      cmocka_unit_test_setup(test_sender_send_failed, sender_setup),
+      cmocka_unit_test_setup(test_sender_drops_on_stop, sender_setup),
+      cmocka_unit_test_setup(test_sender_batch_size, sender_setup),
+      cmocka_unit_test_setup(test_sender_batch_timeout, sender_setup),
+      cmocka_unit_test_setup(test_sender_batch_flush_on_stop, sender_setup),
+  };
+
+  return cmocka_run_group_tests(sender_tests, NULL, NULL);
+}